@@ -0,0 +1,49 @@
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <fstream>
+
+#include "ocr_lexicon.h"
+
+using namespace cv;
+using namespace std;
+
+// Compiles a word list (one word per line) into a lexicon file for OCRHMMDecoder::setLexicon
+int main(int argc, char* argv[]) 
+{
+  if (argc < 3)
+  {
+    cout << "Usage: " << argv[0] << " <word_list.txt> <lexicon_file> [<vocabulary>]" << endl;
+    return(0);
+  }
+
+  // the vocabulary of the OCRHMMDecoder classifiers, labels are indices in it
+  string voc = "abcdefghijklmnopqrtsuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  if (argc > 3)
+    voc = argv[3];
+
+  ifstream list(argv[1]);
+  if (!list)
+  {
+    cout << "Could not open " << argv[1] << endl;
+    return(-1);
+  }
+
+  vector<string> words;
+  string word;
+  while (getline(list, word))
+  {
+    if (!word.empty() && (word[word.size()-1] == '\r'))
+      word.erase(word.size()-1);
+    if (!word.empty())
+      words.push_back(word);
+  }
+
+  int num_words = OCRLexicon::compile(words, voc, argv[2]);
+  OCRLexicon lexicon(argv[2]);
+  cout << "LEXICON_INPUT_WORDS = " << words.size() << endl;
+  cout << "LEXICON_WORDS = " << num_words << endl; // distinct, within the vocabulary
+  cout << "LEXICON_NODES = " << lexicon.numNodes() << endl;
+
+  return(0);
+}
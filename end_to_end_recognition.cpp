@@ -4,94 +4,281 @@
 #include <opencv2/imgproc.hpp>
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 
 #include "ocr_tesseract.h"
+#include "model_registry.h"
+#include "image_context.h"
+#include "erdetection_nm.h"
 #include "ergrouping_nm.h"
+#include "er_draw.h"
 
 using namespace cv;
 using namespace std;
 
+#define OCR_CHECKOUT_TIMEOUT 60000 // max. time (ms) a group waits for an idle OCR engine
+#define OCR_POOL_SIZE        0     // OCR engines, initialized up front (0 = one per thread)
+#define GROUPING_MAX_REGIONS            0 // max. ER's per channel entering grouping (0 = no limit)
+#define GROUPING_MAX_REGIONS_PER_MPIXEL 0 // same, per megapixel (0 = no limit)
+#define GROUPING_MAX_TIME               0 // time budget (ms) of the best-first (anytime) grouping (0 = exhaustive grouping)
+
+// struct word_result
+// A recognized word with its bounding box in image coordinates
+struct word_result
+{
+  string text;
+  Rect   box;
+  float  confidence;
+};
+
+// struct image_result
+// Output of the pipeline for one image, the time spent in each stage (ms)
+// and, if ground truth was given, the evaluation figures
+struct image_result
+{
+  vector<word_result> words;
+  vector<Rect> groups;
+  double time_region_detection;
+  double time_grouping;
+  double time_ocr;
+  int    dropped_regions; // ER's left out of grouping by the region budget
+  bool   evaluated;
+  int    num_gt_characters;
+  int    total_edit_distance;
+  float  edit_distance_ratio;
+  int    tp, fp, fn;
+  image_result() : time_region_detection(0), time_grouping(0), time_ocr(0), dropped_regions(0), evaluated(false),
+                   num_gt_characters(0), total_edit_distance(0), edit_distance_ratio(0), tp(0), fp(0), fn(0) {}
+};
+
 //Calculate edit distance netween two words
 size_t edit_distance(const string& A, const string& B);
 size_t min(size_t x, size_t y, size_t z);
 bool   isRepetitive(const string& s);
 bool   sort_by_lenght(const string &a, const string &b){return (a.size()>b.size());};
 //Draw ER's in an image via floodFill
-void   er_draw(vector<Mat> &channels, vector<vector<ERStat> > &regions, vector<Vec2i> group, Mat& segmentation);
+void   er_draw(vector<Mat> &channels, vector<ERStatArena> &regions, vector<Vec2i> group, Mat& segmentation);
+//Run text detection and recognition on one image,
+//the visualization images are written only if save_images is set, their file names start with images_prefix
+void   recognize_image(Mat& image, OCRTesseractPool* ocr_pool, image_result& result, bool save_images,
+                       const string& images_prefix = "");
+//Evaluate the recognized words against the ground truth with (approximate) hungarian matching and edit distances
+void   evaluate_words(vector<string> words_detection, vector<string> words_gt, image_result& result);
+//Process all the images in a list file (one "<img_filename> <gt_word1> ... <gt_wordN>" per line)
+//keeping the engines loaded, output one JSON record per image and the aggregated metrics at the end.
+//If images_dir is given the visualization images of each image are written there as <image_name>.<kind>.jpg
+int    run_batch(const string& list_filename, const string& images_dir);
+//Quote a string for JSON output
+string json_string(const string& s);
 
 //Perform text detection and recognition and evaluate results using edit distance
 int main(int argc, char* argv[]) 
 {
 
+  if ((argc>2) && (string(argv[1]) == "--batch"))
+    return run_batch(argv[2], (argc>3) ? argv[3] : "");
+
   Mat image;
   if(argc>1)
     image  = imread(argv[1]);
   else
   {
     cout << "Usage: " << argv[0] << " <img_filename> <gt_word1> <gt_word2> ... <gt_wordN>" << endl;
+    cout << "       " << argv[0] << " --batch <list_filename> [<images_dir>]" << endl;
     return(0);
   }
 
   cout << "IMG_W=" << image.cols << endl;
   cout << "IMG_H=" << image.rows << endl;
 
+  double t_r = getTickCount();
+  int ocr_pool_size = (OCR_POOL_SIZE > 0) ? OCR_POOL_SIZE : max(getNumThreads(),1);
+  OCRTesseractPool* ocr_pool = new OCRTesseractPool(ocr_pool_size);
+  ocr_pool->warmUp(ocr_pool_size); // all the engines are initialized here, not by the first groups
+  double time_ocr_initialization = ((double)getTickCount() - t_r)*1000/getTickFrequency();
+
+  image_result result;
+  recognize_image(image, ocr_pool, result, true);
+
+  cout << "TIME_REGION_DETECTION = " << result.time_region_detection << endl;
+  cout << "TIME_GROUPING = " << result.time_grouping << endl;
+  cout << "GROUPING_DROPPED_REGIONS = " << result.dropped_regions << endl;
+  cout << "TIME_OCR_INITIALIZATION = " << time_ocr_initialization << endl;
+  cout << "TIME_OCR = " << result.time_ocr << endl;
+
+  if(argc>2)
+  {
+    vector<string> words_detection;
+    for (size_t j=0; j<result.words.size(); j++)
+      words_detection.push_back(result.words[j].text);
+    vector<string> words_gt;
+    for (int i=2; i<argc; i++)
+      words_gt.push_back(string(argv[i]));
+
+    evaluate_words(words_detection, words_gt, result);
+
+    cout << "TOTAL_EDIT_DISTANCE = " << result.total_edit_distance << endl;
+    cout << "EDIT_DISTANCE_RATIO = " << result.edit_distance_ratio << endl;
+    if (!words_detection.empty())
+    {
+      cout << "TP = " << result.tp << endl;
+      cout << "FP = " << result.fp << endl;
+      cout << "FN = " << result.fn << endl;
+    }
+  }
+
+  delete ocr_pool;
+  return 0;
+}
+
+// struct group_ocr
+// Raw OCR output for one group of regions
+struct group_ocr
+{
+  string         output;
+  vector<Rect>   boxes;
+  vector<string> words;
+  vector<float>  confidences;
+  bool           failed;
+  group_ocr() : failed(false) {}
+};
+
+// class OCRGroupsInvoker
+// Renders and recognizes a range of groups, each one with an engine borrowed from the pool.
+// Every group writes only its own slot of results, so they can be read back in group order.
+// The groups flagged in shared are drawn in place into the shared mask (their ROIs do not
+// overlap, so workers never touch the same pixels) and recognized from their rectangle of it;
+// the others are drawn into the worker's workspace.
+class OCRGroupsInvoker : public ParallelLoopBody
+{
+public:
+  OCRGroupsInvoker(vector<Mat> &_channels, vector<ERStatArena> &_regions, vector< vector<Vec2i> > &_groups,
+                   vector<Rect> &_boxes, Mat &_shared_mask, vector<bool> &_shared,
+                   OCRTesseractPool *_ocr_pool, vector<group_ocr> &_results)
+    : channels(&_channels), regions(&_regions), groups(&_groups), boxes(&_boxes), shared_mask(&_shared_mask),
+      shared(&_shared), ocr_pool(_ocr_pool), results(&_results) {}
+
+  void operator()(const Range& r) const
+  {
+    er_draw_workspace ws; // reused by all the groups of this range
+    for (int i=r.start; i<r.end; i++)
+    {
+      group_ocr &result = (*results)[i];
+
+      // the group box plus a 15 pixels border, in full size mask coordinates
+      Rect roi = ((*boxes)[i] + Size(30,30)) - Point(15,15);
+      // where it is in the shared mask, which has a 15 pixels border around the full size mask
+      Rect shared_roi = roi + Point(15,15);
+      Mat group_img;
+      if ((*shared)[i])
+      {
+        Mat segmentation = (*shared_mask)(shared_roi);
+        er_draw_roi(*channels, *regions, (*groups)[i], roi, segmentation, ws);
+      }
+      else
+        group_img = er_draw_roi(*channels, *regions, (*groups)[i], roi, ws);
+
+      OCRTesseract* ocr = ocr_pool->checkout(OCR_CHECKOUT_TIMEOUT);
+      if (ocr == NULL)
+      {
+        cerr << "OCRGroupsInvoker: no OCR engine available, group " << i << " skipped." << endl;
+        result.failed = true;
+        continue;
+      }
+      try
+      {
+        if ((*shared)[i])
+          ocr->run(*shared_mask, shared_roi, result.output, &result.boxes, &result.words, &result.confidences, OCR_LEVEL_WORD);
+        else
+          ocr->run(group_img, result.output, &result.boxes, &result.words, &result.confidences, OCR_LEVEL_WORD);
+      }
+      catch (...)
+      {
+        ocr_pool->checkin(ocr);
+        throw;
+      }
+      ocr_pool->checkin(ocr);
+
+      Point offset = (*shared)[i] ? Point(-15,-15) : roi.tl();
+      for (size_t j=0; j<result.boxes.size(); j++)
+        result.boxes[j] += offset;
+    }
+  }
+
+private:
+  vector<Mat> *channels;
+  vector<ERStatArena> *regions;
+  vector< vector<Vec2i> > *groups;
+  vector<Rect> *boxes;
+  Mat *shared_mask;
+  vector<bool> *shared;
+  OCRTesseractPool *ocr_pool;
+  vector<group_ocr> *results;
+};
+
+void recognize_image(Mat& image, OCRTesseractPool* ocr_pool, image_result& result, bool save_images,
+                     const string& images_prefix)
+{
+
   /*Text Detection*/
 
   // Extract channels to be processed individually
   vector<Mat> channels;
 
-  Mat grey;
-  cvtColor(image,grey,COLOR_RGB2GRAY);
-
-  channels.push_back(grey);
-  channels.push_back(255-grey);
+  // Images derived from the frame are computed once and shared by all the stages
+  ImageContext context(image);
+  context.channels(channels);
 
   double t_d = getTickCount();
-  // Create ERFilter objects with the 1st and 2nd stage default classifiers
-  Ptr<ERFilter> er_filter1 = createERFilterNM1(loadClassifierNM1("trained_classifierNM1.xml"),8,0.00015,0.13,0.2,true,0.1);
-  Ptr<ERFilter> er_filter2 = createERFilterNM2(loadClassifierNM2("trained_classifierNM2.xml"),0.5);
+  // Get the 1st and 2nd stage default classifiers (ERFilter objects are created per worker)
+  Ptr<ERFilter::Callback> er_classifier1 = ModelRegistry::instance().classifierNM1();
+  Ptr<ERFilter::Callback> er_classifier2 = ModelRegistry::instance().classifierNM2();
 
-  vector<vector<ERStat> > regions(channels.size());
-  // Apply the default cascade classifier to each independent channel (could be done in parallel)
-  for (int c=0; c<(int)channels.size(); c++)
-  {
-      er_filter1->run(channels[c], regions[c]);
-      er_filter2->run(channels[c], regions[c]);
-  }
-  cout << "TIME_REGION_DETECTION = " << ((double)getTickCount() - t_d)*1000/getTickFrequency() << endl;
+  vector<ERStatArena> regions(channels.size());
+  // Apply the default cascade classifier to each independent channel in parallel
+  erDetectionNM(channels, regions, er_classifier1, er_classifier2);
+  result.time_region_detection = ((double)getTickCount() - t_d)*1000/getTickFrequency();
 
-  Mat out_img_decomposition= Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
-  vector<Vec2i> tmp_group;
-  for (int i=0; i<regions.size(); i++)
+  Mat out_img_decomposition;
+  if (save_images)
   {
-    for (int j=0; j<regions[i].size();j++)
+    out_img_decomposition = Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
+    vector<Vec2i> tmp_group;
+    for (int i=0; i<regions.size(); i++)
     {
-      tmp_group.push_back(Vec2i(i,j));
+      for (int j=0; j<regions[i].size();j++)
+      {
+        tmp_group.push_back(Vec2i(i,j));
+      }
+      Mat tmp= Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
+      er_draw(channels, regions, tmp_group, tmp);
+      if (i > 0)
+        tmp = tmp / 2;
+      out_img_decomposition = out_img_decomposition | tmp;
+      tmp_group.clear();
     }
-    Mat tmp= Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
-    er_draw(channels, regions, tmp_group, tmp);
-    if (i > 0)
-      tmp = tmp / 2;
-    out_img_decomposition = out_img_decomposition | tmp;
-    tmp_group.clear();
   }
 
   double t_g = getTickCount();
   // Detect character groups
   vector< vector<Vec2i> > nm_region_groups;
   vector<Rect> nm_boxes;
-  erGroupingNM(image, channels, regions, nm_region_groups, nm_boxes, true);
-  cout << "TIME_GROUPING = " << ((double)getTickCount() - t_g)*1000/getTickFrequency() << endl;
+  grouping_options grouping;
+  grouping.max_regions            = GROUPING_MAX_REGIONS;
+  grouping.max_regions_per_mpixel = GROUPING_MAX_REGIONS_PER_MPIXEL;
+  grouping.anytime                = (GROUPING_MAX_TIME > 0);
+  grouping.max_time               = GROUPING_MAX_TIME;
+  grouping_stats grouping_result;
+  erGroupingNM(context, channels, regions, nm_region_groups, nm_boxes, true, grouping, &grouping_result);
+  result.time_grouping = ((double)getTickCount() - t_g)*1000/getTickFrequency();
+  result.dropped_regions = grouping_result.droppedRegions();
+  result.groups = nm_boxes;
 
 
 
   /*Text Recognition (OCR)*/
 
-  double t_r = getTickCount();
-  OCRTesseract* ocr = new OCRTesseract();
-  cout << "TIME_OCR_INITIALIZATION = " << ((double)getTickCount() - t_r)*1000/getTickFrequency() << endl;
-  string output;
-
   Mat out_img;
   Mat out_img_detection;
   Mat out_img_segmentation = Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
@@ -99,170 +286,355 @@ int main(int argc, char* argv[])
   image.copyTo(out_img_detection);
   float scale_img  = 600./image.rows;
   float scale_font = (2-scale_img)/1.4;
-  vector<string> words_detection;
  
-  t_r = getTickCount();
+  double t_r = getTickCount();
 
+  // Groups are drawn into a single shared mask (with a 15 pixels border so that every group
+  // ROI fits in it) and recognized from their own rectangle of it. A group whose ROI overlaps
+  // the ROI of a shared group would see its pixels, so it is drawn on its own instead.
+  vector<bool> shared(nm_boxes.size(), false);
+  vector<Rect> shared_rois;
+  for (int i=0; i<nm_boxes.size(); i++)
+  {
+    Rect roi = (nm_boxes[i] + Size(30,30)) - Point(15,15);
+    bool overlaps = false;
+    for (size_t j=0; (j<shared_rois.size()) && !overlaps; j++)
+      overlaps = ((roi & shared_rois[j]).area() > 0);
+    if (overlaps)
+      continue;
+    shared[i] = true;
+    shared_rois.push_back(roi);
+  }
+  Mat shared_mask;
+  if (!shared_rois.empty())
+    shared_mask = Mat::zeros(image.rows+2+30, image.cols+2+30, CV_8UC1);
+
+  // Recognize the groups in parallel
+  vector<group_ocr> ocr_results(nm_boxes.size());
+  parallel_for_(Range(0,(int)nm_boxes.size()),
+                OCRGroupsInvoker(channels, regions, nm_region_groups, nm_boxes, shared_mask, shared, ocr_pool, ocr_results));
+
+  // and collect the results in the original group order
+  er_draw_workspace ws;
   for (int i=0; i<nm_boxes.size(); i++)
   {
 
     rectangle(out_img_detection, nm_boxes[i].tl(), nm_boxes[i].br(), Scalar(0,255,255), 3);
 
-    Mat group_img = Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
-    er_draw(channels, regions, nm_region_groups[i], group_img);
-    Mat group_segmentation;
-    group_img.copyTo(group_segmentation);
-    //image(nm_boxes[i]).copyTo(group_img);
-    group_img(nm_boxes[i]).copyTo(group_img);
-    copyMakeBorder(group_img,group_img,15,15,15,15,BORDER_CONSTANT,Scalar(0));
+    if (ocr_results[i].failed)
+      continue;
 
-    vector<Rect>   boxes;
-    vector<string> words;
-    vector<float>  confidences;
-    ocr->run(group_img, output, &boxes, &words, &confidences, OCR_LEVEL_WORD);
+    string&         output      = ocr_results[i].output;
+    vector<Rect>&   boxes       = ocr_results[i].boxes;
+    vector<string>& words       = ocr_results[i].words;
+    vector<float>&  confidences = ocr_results[i].confidences;
+    bool            drawn       = false;
 
     output.erase(remove(output.begin(), output.end(), '\n'), output.end());
     //cout << "OCR output = \"" << output << "\" lenght = " << output.size() << endl;
     if (output.size() < 3)
       continue;
 
+    // boxes are already in (mask) image coordinates
     for (int j=0; j<boxes.size(); j++)
     {
-      boxes[j].x += nm_boxes[i].x-15;
-      boxes[j].y += nm_boxes[i].y-15;
-
       //cout << "  word = " << words[j] << "\t confidence = " << confidences[j] << endl;
       if ((words[j].size() < 2) || (confidences[j] < 51) || 
           ((words[j].size()==2) && (words[j][0] == words[j][1])) ||
           ((words[j].size()< 4) && (confidences[j] < 60)) ||
           isRepetitive(words[j]))
         continue;
-      words_detection.push_back(words[j]);
+      word_result word;
+      word.text       = words[j];
+      word.box        = boxes[j];
+      word.confidence = confidences[j];
+      result.words.push_back(word);
       rectangle(out_img, boxes[j].tl(), boxes[j].br(), Scalar(255,0,255),3);
       Size word_size = getTextSize(words[j], FONT_HERSHEY_SIMPLEX, scale_font, 3*scale_font, NULL);
       rectangle(out_img, boxes[j].tl()-Point(3,word_size.height+3), boxes[j].tl()+Point(word_size.width,0), Scalar(255,0,255),-1);
       putText(out_img, words[j], boxes[j].tl()-Point(1,1), FONT_HERSHEY_SIMPLEX, scale_font, Scalar(255,255,255),3*scale_font);
-      out_img_segmentation = out_img_segmentation | group_segmentation;
+      if (save_images && !drawn)
+      {
+        er_draw_or(out_img_segmentation, er_draw_roi(channels, regions, nm_region_groups[i], nm_boxes[i] + Size(2,2), ws), nm_boxes[i] + Size(2,2));
+        drawn = true;
+      }
     }
 
   }
 
-  cout << "TIME_OCR = " << ((double)getTickCount() - t_r)*1000/getTickFrequency() << endl;
-
+  result.time_ocr = ((double)getTickCount() - t_r)*1000/getTickFrequency();
 
-  /* Recognition evaluation with (approximate) hungarian matching and edit distances */
+  if (save_images)
+  {
+    //resize(out_img_detection,out_img_detection,Size(image.cols*scale_img,image.rows*scale_img));
+    //imshow("detection", out_img_detection);
+    imwrite(images_prefix+"detection.jpg", out_img_detection);
+    //resize(out_img,out_img,Size(image.cols*scale_img,image.rows*scale_img));
+    //imshow("recognition", out_img);
+    imwrite(images_prefix+"recognition.jpg", out_img);
+    //waitKey(0);
+    imwrite(images_prefix+"segmentation.jpg", out_img_segmentation);
+    imwrite(images_prefix+"decomposition.jpg", out_img_decomposition);
+  }
+}
 
-  if(argc>2)
+void evaluate_words(vector<string> words_detection, vector<string> input_gt, image_result& result)
+{
+  int num_gt_characters   = 0;
+  vector<string> words_gt;
+  for (int i=0; i<input_gt.size(); i++)
   {
-    int num_gt_characters   = 0;
-    vector<string> words_gt;
-    for (int i=2; i<argc; i++)
+    string s = input_gt[i];
+    if (s.size() > 0)
     {
-      string s = string(argv[i]);
-      if (s.size() > 0)
-      {
-        words_gt.push_back(string(argv[i]));
-        //cout << " GT word " << words_gt[words_gt.size()-1] << endl;
-        num_gt_characters += words_gt[words_gt.size()-1].size();
-      }
+      words_gt.push_back(s);
+      //cout << " GT word " << words_gt[words_gt.size()-1] << endl;
+      num_gt_characters += words_gt[words_gt.size()-1].size();
     }
+  }
 
-    if (words_detection.empty())
+  result.evaluated = true;
+  result.num_gt_characters = num_gt_characters;
+
+  if (words_detection.empty())
+  {
+    //cout << endl << "number of characters in gt = " << num_gt_characters << endl;
+    result.total_edit_distance = num_gt_characters;
+    result.edit_distance_ratio = 1;
+    result.fn = words_gt.size();
+    return;
+  }
+
+  sort(words_gt.begin(),words_gt.end(),sort_by_lenght);
+
+  int max_dist=0;
+  vector< vector<int> > assignment_mat;
+  for (int i=0; i<words_gt.size(); i++)
+  {
+    vector<int> assignment_row(words_detection.size(),0);
+    assignment_mat.push_back(assignment_row);
+    for (int j=0; j<words_detection.size(); j++)
     {
-      //cout << endl << "number of characters in gt = " << num_gt_characters << endl;
-      cout << "TOTAL_EDIT_DISTANCE = " << num_gt_characters << endl;
-      cout << "EDIT_DISTANCE_RATIO = 1" << endl;
+      assignment_mat[i][j] = edit_distance(words_gt[i],words_detection[j]);
+      max_dist = max(max_dist,assignment_mat[i][j]);
     }
-    else
-    {
-
-      sort(words_gt.begin(),words_gt.end(),sort_by_lenght);
+  }
+    
+  vector<int> words_detection_matched;
 
-      int max_dist=0;
-      vector< vector<int> > assignment_mat;
-      for (int i=0; i<words_gt.size(); i++)
-      {
-        vector<int> assignment_row(words_detection.size(),0);
-        assignment_mat.push_back(assignment_row);
-        for (int j=0; j<words_detection.size(); j++)
-        {
-          assignment_mat[i][j] = edit_distance(words_gt[i],words_detection[j]);
-          max_dist = max(max_dist,assignment_mat[i][j]);
-        }
-      }
-        
-      vector<int> words_detection_matched;
-  
-      int total_edit_distance = 0;
-      int assigned_gt_words=0;
-      int tp=0, fp=0, fn=0; 
-      for (int search_dist=0; search_dist<=max_dist; search_dist++)
-      {
-        for (int i=0; i<assignment_mat.size(); i++)
-        {
-          int min_dist_idx =  distance(assignment_mat[i].begin(),
-                                       min_element(assignment_mat[i].begin(),assignment_mat[i].end()));
-          if (assignment_mat[i][min_dist_idx] == search_dist)
-          {
-            //cout << " GT word \"" << words_gt[i] << "\" best match \"" << words_detection[min_dist_idx] << "\" with dist " << assignment_mat[i][min_dist_idx] << endl;
-            if(search_dist == 0) 
-		tp++;
-            else { fp++; fn++; }
-	    
-            total_edit_distance += assignment_mat[i][min_dist_idx];
-            words_detection_matched.push_back(min_dist_idx);
-            words_gt.erase(words_gt.begin()+i);
-            assignment_mat.erase(assignment_mat.begin()+i);
-            for (int j=0; j<assignment_mat.size(); j++)
-            {
-              assignment_mat[j][min_dist_idx]=INT_MAX;
-            }
-            i--;
-          }
-        }
-      }
-  
-      for (int j=0; j<words_gt.size(); j++)
-      {
-        //cout << " GT word \"" << words_gt[j] << "\" no match found" << endl;
-        fn++;
-        total_edit_distance += words_gt[j].size();
-      }
-      for (int j=0; j<words_detection.size(); j++)
+  int total_edit_distance = 0;
+  int tp=0, fp=0, fn=0; 
+  for (int search_dist=0; search_dist<=max_dist; search_dist++)
+  {
+    for (int i=0; i<assignment_mat.size(); i++)
+    {
+      int min_dist_idx =  distance(assignment_mat[i].begin(),
+                                   min_element(assignment_mat[i].begin(),assignment_mat[i].end()));
+      if (assignment_mat[i][min_dist_idx] == search_dist)
       {
-        if (find(words_detection_matched.begin(),words_detection_matched.end(),j) == words_detection_matched.end())
+        //cout << " GT word \"" << words_gt[i] << "\" best match \"" << words_detection[min_dist_idx] << "\" with dist " << assignment_mat[i][min_dist_idx] << endl;
+        if(search_dist == 0) 
+          tp++;
+        else { fp++; fn++; }
+
+        total_edit_distance += assignment_mat[i][min_dist_idx];
+        words_detection_matched.push_back(min_dist_idx);
+        words_gt.erase(words_gt.begin()+i);
+        assignment_mat.erase(assignment_mat.begin()+i);
+        for (int j=0; j<assignment_mat.size(); j++)
         {
-          //cout << " Detection word \"" << words_detection[j] << "\" no match found" << endl;
-          fp++;
-          total_edit_distance += words_detection[j].size();
+          assignment_mat[j][min_dist_idx]=INT_MAX;
         }
+        i--;
       }
-  
-    
-      //cout << endl << "number of characters in gt = " << num_gt_characters << endl;
-      cout << "TOTAL_EDIT_DISTANCE = " << total_edit_distance << endl;
-      cout << "EDIT_DISTANCE_RATIO = " << (float)total_edit_distance / num_gt_characters << endl;
-      cout << "TP = " << tp << endl;
-      cout << "FP = " << fp << endl;
-      cout << "FN = " << fn << endl;
     }
   }
 
+  for (int j=0; j<words_gt.size(); j++)
+  {
+    //cout << " GT word \"" << words_gt[j] << "\" no match found" << endl;
+    fn++;
+    total_edit_distance += words_gt[j].size();
+  }
+  for (int j=0; j<words_detection.size(); j++)
+  {
+    if (find(words_detection_matched.begin(),words_detection_matched.end(),j) == words_detection_matched.end())
+    {
+      //cout << " Detection word \"" << words_detection[j] << "\" no match found" << endl;
+      fp++;
+      total_edit_distance += words_detection[j].size();
+    }
+  }
+
+  //cout << endl << "number of characters in gt = " << num_gt_characters << endl;
+  result.total_edit_distance = total_edit_distance;
+  result.edit_distance_ratio = (float)total_edit_distance / num_gt_characters;
+  result.tp = tp;
+  result.fp = fp;
+  result.fn = fn;
+}
+
+int run_batch(const string& list_filename, const string& images_dir)
+{
+  ifstream list(list_filename.c_str());
+  if (!list)
+  {
+    cerr << "Could not open list file " << list_filename << endl;
+    return(1);
+  }
+
+  // Engines are initialized once and stay warm for all the images
+  double t_r = getTickCount();
+  ModelRegistry::instance().classifierNM1();
+  ModelRegistry::instance().classifierNM2();
+  int ocr_pool_size = (OCR_POOL_SIZE > 0) ? OCR_POOL_SIZE : max(getNumThreads(),1);
+  OCRTesseractPool* ocr_pool = new OCRTesseractPool(ocr_pool_size);
+  ocr_pool->warmUp(ocr_pool_size); // all the engines are initialized here, not by the first groups
+  double time_initialization = ((double)getTickCount() - t_r)*1000/getTickFrequency();
+
+  int    num_images = 0, num_evaluated = 0, num_failed = 0;
+  int    total_edit_distance = 0;
+  double edit_distance_ratio = 0;
+  double total_time_regions = 0, total_time_grouping = 0, total_time_ocr = 0;
+  int    tp = 0, fp = 0, fn = 0;
+
+  string line;
+  while (getline(list, line))
+  {
+    istringstream fields(line);
+    string img_filename;
+    if (!(fields >> img_filename))
+      continue;
+    vector<string> words_gt;
+    string word;
+    while (fields >> word)
+      words_gt.push_back(word);
 
+    Mat image = imread(img_filename);
+    if (image.empty())
+    {
+      num_failed++;
+      cout << "{\"image\":" << json_string(img_filename) << ",\"error\":\"could not read image\"}" << endl;
+      continue;
+    }
 
-  //resize(out_img_detection,out_img_detection,Size(image.cols*scale_img,image.rows*scale_img));
-  //imshow("detection", out_img_detection);
-  imwrite("detection.jpg", out_img_detection);
-  //resize(out_img,out_img,Size(image.cols*scale_img,image.rows*scale_img));
-  //imshow("recognition", out_img);
-  imwrite("recognition.jpg", out_img);
-  //waitKey(0);
-  imwrite("segmentation.jpg", out_img_segmentation);
-  imwrite("decomposition.jpg", out_img_decomposition);
+    image_result result;
+    if (images_dir.empty())
+      recognize_image(image, ocr_pool, result, false);
+    else
+    {
+      // <images_dir>/<image name without path and extension>.
+      string name = img_filename.substr(img_filename.find_last_of('/')+1);
+      name = name.substr(0, name.find_last_of('.'));
+      recognize_image(image, ocr_pool, result, true, images_dir + "/" + name + ".");
+    }
+
+    vector<string> words_detection;
+    for (size_t j=0; j<result.words.size(); j++)
+      words_detection.push_back(result.words[j].text);
+    if (!words_gt.empty())
+      evaluate_words(words_detection, words_gt, result);
+
+    ostringstream record;
+    record << "{\"image\":" << json_string(img_filename)
+           << ",\"width\":" << image.cols << ",\"height\":" << image.rows;
+    string text;
+    for (size_t j=0; j<words_detection.size(); j++)
+      text += (j>0 ? " " : "") + words_detection[j];
+    record << ",\"text\":" << json_string(text);
+    record << ",\"words\":[";
+    for (size_t j=0; j<result.words.size(); j++)
+    {
+      const word_result& w = result.words[j];
+      record << (j>0 ? "," : "") << "{\"text\":" << json_string(w.text)
+             << ",\"box\":[" << w.box.x << "," << w.box.y << "," << w.box.width << "," << w.box.height << "]"
+             << ",\"confidence\":" << w.confidence << "}";
+    }
+    record << "],\"groups\":[";
+    for (size_t j=0; j<result.groups.size(); j++)
+    {
+      const Rect& g = result.groups[j];
+      record << (j>0 ? "," : "") << "[" << g.x << "," << g.y << "," << g.width << "," << g.height << "]";
+    }
+    record << "],\"time_ms\":{\"region_detection\":" << result.time_region_detection
+           << ",\"grouping\":" << result.time_grouping << ",\"ocr\":" << result.time_ocr << "}"
+           << ",\"dropped_regions\":" << result.dropped_regions;
+    if (result.evaluated)
+    {
+      record << ",\"evaluation\":{\"total_edit_distance\":" << result.total_edit_distance
+             << ",\"edit_distance_ratio\":" << result.edit_distance_ratio
+             << ",\"tp\":" << result.tp << ",\"fp\":" << result.fp << ",\"fn\":" << result.fn << "}";
+    }
+    record << "}";
+    cout << record.str() << endl;
+
+    num_images++;
+    total_time_regions  += result.time_region_detection;
+    total_time_grouping += result.time_grouping;
+    total_time_ocr      += result.time_ocr;
+    if (result.evaluated)
+    {
+      num_evaluated++;
+      total_edit_distance += result.total_edit_distance;
+      edit_distance_ratio += result.edit_distance_ratio;
+      tp += result.tp;
+      fp += result.fp;
+      fn += result.fn;
+    }
+  }
+
+  delete ocr_pool;
+
+  // Aggregated metrics (same figures eval_all.py used to compute)
+  ostringstream summary;
+  summary << "{\"summary\":{\"images\":" << num_images << ",\"failed\":" << num_failed
+          << ",\"time_ms\":{\"initialization\":" << time_initialization
+          << ",\"avg_region_detection\":" << (num_images ? total_time_regions/num_images : 0)
+          << ",\"avg_grouping\":" << (num_images ? total_time_grouping/num_images : 0)
+          << ",\"avg_ocr\":" << (num_images ? total_time_ocr/num_images : 0) << "}";
+  if (num_evaluated > 0)
+  {
+    summary << ",\"evaluation\":{\"images\":" << num_evaluated
+            << ",\"total_edit_distance\":" << total_edit_distance
+            << ",\"avg_edit_distance_ratio\":" << edit_distance_ratio/num_evaluated
+            << ",\"tp\":" << tp << ",\"fp\":" << fp << ",\"fn\":" << fn
+            << ",\"f_score\":" << ((tp+fp+fn) ? 2.0*tp/(2*tp+fp+fn) : 0)
+            << ",\"precision\":" << ((tp+fp) ? (float)tp/(tp+fp) : 0)
+            << ",\"recall\":" << ((tp+fn) ? (float)tp/(tp+fn) : 0) << "}";
+  }
+  summary << "}}";
+  cout << summary.str() << endl;
 
   return 0;
 }
 
+string json_string(const string& s)
+{
+  string out = "\"";
+  for (size_t i=0; i<s.size(); i++)
+  {
+    unsigned char ch = s[i];
+    switch (ch)
+    {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n";  break;
+      case '\r': out += "\\r";  break;
+      case '\t': out += "\\t";  break;
+      default:
+        if (ch < 0x20)
+        {
+          char buff[8];
+          sprintf(buff, "\\u%04x", ch);
+          out += buff;
+        }
+        else
+          out += s[i];
+    }
+  }
+  return out + "\"";
+}
+
 size_t min(size_t x, size_t y, size_t z)
 {
   return x < y ? min(x,z) : min(y,z);
@@ -311,7 +683,7 @@ bool isRepetitive(const string& s)
 }
 
 
-void er_draw(vector<Mat> &channels, vector<vector<ERStat> > &regions, vector<Vec2i> group, Mat& segmentation)
+void er_draw(vector<Mat> &channels, vector<ERStatArena> &regions, vector<Vec2i> group, Mat& segmentation)
 {
   for (int r=0; r<(int)group.size(); r++)
   {
@@ -0,0 +1,92 @@
+#include  <vector>
+
+#include "erstat_arena.h"
+
+using  namespace std;
+using  namespace cv;
+
+// struct er_draw_workspace
+// Scratch buffers for er_draw_roi, they only grow so a worker can reuse them across groups
+struct er_draw_workspace
+{
+    Mat segmentation;
+    Mat mask;
+};
+
+// Draw the ER's of a group via floodFill, but only inside roi
+// roi is given in the coordinates of the full size masks used by er_draw (image size + 2,
+// pixel (x,y) of the image at (x+1,y+1)) and may extend beyond them (that part is left empty)
+// out a view of ws.segmentation with the size of roi, valid until the next call with ws
+// Each ER is flood-filled on its own channel ROI with a mask of its rect size, so the cost
+// depends on the size of the group and not on the size of the image
+Mat er_draw_roi(vector<Mat> &channels, vector<ERStatArena> &regions, const vector<Vec2i> &group,
+                const Rect &roi, er_draw_workspace &ws);
+
+// Same as above, but draws into segmentation (a Mat, or a view of a larger one, with the size
+// of roi) instead of ws.segmentation; the pixels of segmentation are cleared first
+void er_draw_roi(vector<Mat> &channels, vector<ERStatArena> &regions, const vector<Vec2i> &group,
+                 const Rect &roi, Mat &segmentation, er_draw_workspace &ws);
+
+// ORs a group mask rendered with er_draw_roi into a full size mask
+void er_draw_or(Mat &segmentation, const Mat &group_segmentation, const Rect &roi);
+
+
+Mat er_draw_roi(vector<Mat> &channels, vector<ERStatArena> &regions, const vector<Vec2i> &group,
+                const Rect &roi, er_draw_workspace &ws)
+{
+    if ((ws.segmentation.rows < roi.height) || (ws.segmentation.cols < roi.width))
+        ws.segmentation.create(max(ws.segmentation.rows,roi.height), max(ws.segmentation.cols,roi.width), CV_8UC1);
+    Mat segmentation = ws.segmentation(Rect(0,0,roi.width,roi.height));
+    er_draw_roi(channels, regions, group, roi, segmentation, ws);
+    return segmentation;
+}
+
+void er_draw_roi(vector<Mat> &channels, vector<ERStatArena> &regions, const vector<Vec2i> &group,
+                 const Rect &roi, Mat &segmentation, er_draw_workspace &ws)
+{
+    CV_Assert((segmentation.rows == roi.height) && (segmentation.cols == roi.width));
+    segmentation = Scalar(0);
+
+    int newMaskVal = 255;
+    int flags = 4 + (newMaskVal << 8) + FLOODFILL_FIXED_RANGE + FLOODFILL_MASK_ONLY;
+
+    for (int r=0; r<(int)group.size(); r++)
+    {
+        ERStat &er = regions[group[r][0]][group[r][1]];
+        if (er.parent == NULL) // deprecate the root region
+            continue;
+
+        Mat &channel = channels[group[r][0]];
+        Rect er_rect = er.rect & Rect(0,0,channel.cols,channel.rows);
+        // floodFill mask of the ER rect and the part of it that maps to image pixels
+        Rect mask_rect(er_rect.x, er_rect.y, er_rect.width+2, er_rect.height+2);
+        Rect inner_rect(er_rect.x+1, er_rect.y+1, er_rect.width, er_rect.height);
+
+        if ((ws.mask.rows < mask_rect.height) || (ws.mask.cols < mask_rect.width))
+            ws.mask.create(max(ws.mask.rows,mask_rect.height), max(ws.mask.cols,mask_rect.width), CV_8UC1);
+        Mat mask = ws.mask(Rect(0,0,mask_rect.width,mask_rect.height));
+        mask = Scalar(0);
+
+        // pixels already drawn stop the fill, as they do in a shared full size mask
+        Rect overlap = mask_rect & roi;
+        if (overlap.area() > 0)
+            segmentation(overlap - roi.tl()).copyTo(mask(overlap - mask_rect.tl()));
+
+        floodFill(channel(er_rect), mask, Point(er.pixel%channel.cols - er_rect.x, er.pixel/channel.cols - er_rect.y),
+                  Scalar(255),0,Scalar(er.level),Scalar(0),flags);
+
+        // floodFill overwrites the mask border, so only the inner part is copied back
+        overlap = inner_rect & roi;
+        if (overlap.area() > 0)
+            mask(overlap - mask_rect.tl()).copyTo(segmentation(overlap - roi.tl()));
+    }
+}
+
+void er_draw_or(Mat &segmentation, const Mat &group_segmentation, const Rect &roi)
+{
+    Rect visible = roi & Rect(0,0,segmentation.cols,segmentation.rows);
+    if (visible.area() == 0)
+        return;
+    Mat dst = segmentation(visible);
+    bitwise_or(dst, group_segmentation(visible - roi.tl()), dst);
+}
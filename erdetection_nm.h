@@ -0,0 +1,61 @@
+#include  <vector>
+
+#include "erstat_arena.h"
+
+using  namespace std;
+using  namespace cv;
+
+// class ERDetectionNMInvoker
+// Applies the default two-stage ERFilter cascade to a range of channels.
+// ERFilter keeps per-run state (region tree, mask) and is not reentrant, so every
+// worker creates its own pair of filters; the classifier callbacks are read-only
+// and shared by all workers.
+class ERDetectionNMInvoker : public ParallelLoopBody
+{
+public:
+    ERDetectionNMInvoker(vector<Mat> &_channels, vector<ERStatArena> &_regions,
+                         const Ptr<ERFilter::Callback> &_cb1, const Ptr<ERFilter::Callback> &_cb2)
+        : channels(&_channels), regions(&_regions), cb1(_cb1), cb2(_cb2) {}
+
+    void operator()(const Range& r) const
+    {
+        for (int c=r.start; c<r.end; c++)
+        {
+            Ptr<ERFilter> er_filter1 = createERFilterNM1(cb1,8,0.00015,0.13,0.2,true,0.1);
+            Ptr<ERFilter> er_filter2 = createERFilterNM2(cb2,0.5);
+
+            // ERFilter only fills a vector, the resulting tree is then copied into the arena
+            vector<ERStat> channel_regions;
+            er_filter1->run((*channels)[c], channel_regions);
+            er_filter2->run((*channels)[c], channel_regions);
+            (*regions)[c].assign(channel_regions);
+        }
+    }
+
+private:
+    vector<Mat> *channels;
+    vector<ERStatArena> *regions;
+    Ptr<ERFilter::Callback> cb1;
+    Ptr<ERFilter::Callback> cb2;
+};
+
+// Extract ER's from each channel (in parallel) with the default NM1+NM2 cascade
+// in _src the channels to be processed individually
+// out regions[c] the ER's extracted from channel c
+void erDetectionNM(InputArrayOfArrays _src, vector<ERStatArena> &regions,
+                   const Ptr<ERFilter::Callback> &cb1, const Ptr<ERFilter::Callback> &cb2);
+
+void erDetectionNM(InputArrayOfArrays _src, vector<ERStatArena> &regions,
+                   const Ptr<ERFilter::Callback> &cb1, const Ptr<ERFilter::Callback> &cb2)
+{
+    vector<Mat> channels;
+    _src.getMatVector(channels);
+
+    CV_Assert ( !channels.empty() );
+
+    regions.clear();
+    regions.resize(channels.size());
+
+    // each channel writes only its own regions[c], so the output does not depend on scheduling
+    parallel_for_(Range(0,(int)channels.size()), ERDetectionNMInvoker(channels, regions, cb1, cb2));
+}
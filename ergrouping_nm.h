@@ -1,7 +1,18 @@
 #include  <vector>
+#include  <map>
+#include  <queue>
+#include  <functional>
 #include  <iostream>
 #include  <iomanip>
 
+#include "model_registry.h"
+#include "erstat_arena.h"
+#include "image_context.h"
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 using  namespace std;
 using  namespace cv;
 
@@ -14,12 +25,19 @@ using  namespace cv;
 #define PAIR_MAX_INTENSITY_DIST   111
 #define PAIR_MAX_AB_DIST          54
 
+//slack of the (vectorized) geometric screen of pair candidates w.r.t. the thresholds above
+#define PAIR_SCREEN_TOLERANCE     1e-3
+
 #define TRIPLET_MAX_DIST          0.9
 #define TRIPLET_MAX_SLOPE         0.3
 
 #define SEQUENCE_MAX_TRIPLET_DIST 0.45
 #define SEQUENCE_MIN_LENGHT       4
 
+//area sanity checks of the region budget, regions failing them are dropped first
+#define BUDGET_MIN_AREA           4
+#define BUDGET_MIN_FILL_RATIO     0.05
+
 // struct line_estimates
 // Represents a line estimate (as above) for an ER's group
 // i.e.: slope and intercept of 2 top and 2 bottom lines
@@ -146,29 +164,285 @@ struct region_sequence
     region_sequence () {}
 };
 
-// Evaluates if a pair of regions is valid or not
+// struct pair_index
+// Spatial index of the regions of one channel, used to find the regions that
+// can pass the geometric checks of isValidPair without testing all of them.
+// Regions are bucketed by height octave (floor(log2(height))) and sorted by x
+// within each bucket, every bucket keeps the max. width of its regions.
+struct pair_index
+{
+    struct bucket
+    {
+        vector< pair<int,int> > regions; // (rect.x, region index) sorted by rect.x
+        int max_width;
+        bucket() : max_width(0) {}
+    };
+    vector<bucket> buckets;
+};
+
+// struct region_appearance
+// Mean grey level and mean Lab a/b of the pixels of a region
+struct region_appearance
+{
+    bool  computed;
+    int   grey_mean;
+    float a_mean;
+    float b_mean;
+    region_appearance() : computed(false), grey_mean(0), a_mean(0), b_mean(0) {}
+};
+
+// struct region_table
+// Packed copy of what grouping reads from the regions of one channel, one array per field.
+// The pair, triplet and line-fit checks scan these small arrays instead of whole ERStat's
+// (moments, crossings, tree pointers, ...). Rows are indexed as the regions (idx[1]), the
+// appearance of a region is measured on demand (see getRegionAppearance).
+struct region_table
+{
+    vector<int> x, y, width, height;  // rect
+    vector<int> cx, cy;               // rect center
+    vector<int> level;
+    vector<int> pixel;                // seed pixel (y*cols+x)
+    vector<float> probability;
+    vector<unsigned char> is_root;    // parent == NULL
+    vector<unsigned char> selected;   // enters the pair search (see selectRegions)
+    vector<region_appearance> appearance;
+
+    size_t size() const { return x.size(); }
+    Rect rect(int r) const { return Rect(x[r], y[r], width[r], height[r]); }
+    void push_back(const ERStat &er)
+    {
+        x.push_back(er.rect.x);
+        y.push_back(er.rect.y);
+        width.push_back(er.rect.width);
+        height.push_back(er.rect.height);
+        cx.push_back(er.rect.x+er.rect.width/2);
+        cy.push_back(er.rect.y+er.rect.height/2);
+        level.push_back(er.level);
+        pixel.push_back(er.pixel);
+        probability.push_back((float)er.probability);
+        is_root.push_back(er.parent == NULL);
+        selected.push_back(1);
+        appearance.push_back(region_appearance());
+    }
+};
+
+// Builds the region_table of a channel's regions
+void buildRegionTable(ERStatArena &regions, region_table &table);
+
+// Builds the pair_index of a channel's regions (only the selected ones)
+void buildPairIndex(region_table &table, pair_index &index);
+
+// Adds (removes) region r to (from) a pair_index
+void addToPairIndex(region_table &table, int r, pair_index &index);
+void removeFromPairIndex(region_table &table, int r, pair_index &index);
+
+// Finds the regions j > i that may form a valid pair with region i
+// i.e. a superset of the j's for which isValidPair(i,j) can be true
+// out candidates in ascending order
+void findPairCandidates(region_table &table, pair_index &index, int i, vector<int> &candidates);
+
+// Same as findPairCandidates, for all the regions j != i
+void findPairNeighbours(region_table &table, pair_index &index, int i, vector<int> &candidates);
+
+// Screens a block of candidates for a pair with region i with the geometric checks of isValidPair
+// (height ratio, centroid angle and region distance), four candidates at a time when SSE2 is
+// available. The centroid angle interval is checked as bounds on the slope between centers
+// instead of calling atan2. The screen is slightly permissive (PAIR_SCREEN_TOLERANCE), survivors
+// still have to pass isValidPair.
+// in/out candidates, only the survivors are kept (in the same order)
+void screenPairCandidates(region_table &table, int i, vector<int> &candidates);
+
+// Returns the appearance of region idx, measuring it the first time it is requested
+// in channel the channel the regions of table were extracted from
+// in/out mask a CV_8UC1 scratch mask (may be empty), it is grown to the region's rect size + 2
+// when needed, so a worker can reuse it for all the regions it measures
+region_appearance& getRegionAppearance(Mat &grey, Mat &lab, Mat &mask, Mat &channel, region_table &table, int idx);
+
+// Evaluates if a pair of regions (of the same channel) is valid or not
 // using thresholds learned on training (defined above)
-bool isValidPair(Mat &grey, Mat& lab, Mat& mask, vector<Mat> &channels, std::vector< std::vector<ERStat> >& regions, cv::Vec2i idx1, cv::Vec2i idx2);
+bool isValidPair(Mat &grey, Mat& lab, Mat& mask, Mat &channel, region_table &table, int idx1, int idx2);
+
+// The two parts of isValidPair: the geometric checks (height ratio, centroid angle,
+// region distance, ...) and the comparison of the appearance of both regions
+bool isValidPairGeometry(region_table &table, int idx1, int idx2);
+bool isValidPairAppearance(const region_appearance &appearance1, const region_appearance &appearance2);
 
-// Evaluates if a set of 3 regions is valid or not
+// Evaluates if a set of 3 regions (of the same channel) is valid or not
 // using thresholds learned on training (defined above)
-bool isValidTriplet(std::vector< std::vector<ERStat> >& regions, region_pair pair1, region_pair pair2, region_triplet &triplet);
+bool isValidTriplet(region_table &table, region_pair pair1, region_pair pair2, region_triplet &triplet);
 
 // Evaluates if a set of more than 3 regions is valid or not
 // using thresholds learned on training (defined above)
 bool isValidSequence(region_sequence &sequence1, region_sequence &sequence2);
 
+// Evaluates if two triplets are consistent with being part of the same sequence
+// (two sequences are valid together if any of their triplets are)
+bool isValidSequence(region_triplet &triplet1, region_triplet &triplet2);
+
+// struct sequence_index
+// Spatial index of triplets, used to find the triplets that can be consistent with a
+// given one (see isValidSequence) without testing all of them.
+// Triplets are bucketed by h_max octave, and within each bucket in a grid keyed by
+// their x-range and by the band their top/bottom lines cover at the triplet centre.
+struct sequence_index
+{
+    struct bucket
+    {
+        int cell_size;
+        int max_height;
+        int max_width;
+        map< pair<int,int>, vector<int> > cells;
+        bucket() : cell_size(0), max_height(0), max_width(0) {}
+    };
+    vector<bucket> buckets;
+};
+
+// Builds the sequence_index of a set of triplets
+void buildSequenceIndex(vector<region_triplet> &triplets, sequence_index &index);
+
+// Adds triplet t to a sequence_index
+void addToSequenceIndex(vector<region_triplet> &triplets, int t, sequence_index &index);
+
+// Finds the triplets that may be consistent with triplet t
+// i.e. a superset of the ones for which isValidSequence(t, other) can be true
+// out candidates in ascending order (t itself may be included)
+void findSequenceCandidates(vector<region_triplet> &triplets, sequence_index &index, int t, vector<int> &candidates);
+
+// struct disjoint_sets
+// Union-find over indices (e.g. the triplets of a sequence, each set represented by its first triplet)
+struct disjoint_sets
+{
+    vector<int> parent;
+    disjoint_sets(int n) : parent(n)
+    {
+        for (int i=0; i<n; i++)
+            parent[i] = i;
+    }
+    int find(int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+    // joins the set of j into the set of i (i stays as representative)
+    void unite(int i, int j)
+    {
+        parent[find(j)] = find(i);
+    }
+    // adds a new set with a single index, returns the index
+    int add()
+    {
+        parent.push_back((int)parent.size());
+        return (int)parent.size()-1;
+    }
+};
+
 // Check if two sequences share a region in common
 bool haveCommonRegion(region_sequence &sequence1, region_sequence &sequence2);
 // Check if two triplets share a region in common
 bool haveCommonRegion(region_triplet &t1, region_triplet &t2);
 
+// struct region_bitset
+// Compact set of the regions (of a single channel) of a sequence: one bit per region
+// index, stored only for the 64-bit words between the lowest and highest index
+struct region_bitset
+{
+    int first_word;
+    vector<uint64> words;
+    region_bitset() : first_word(0) {}
+    bool intersects(const region_bitset &other) const
+    {
+        int from = max(first_word, other.first_word);
+        int to   = min(first_word+(int)words.size(), other.first_word+(int)other.words.size());
+        for (int w=from; w<to; w++)
+            if (words[w-first_word] & other.words[w-other.first_word])
+                return true;
+        return false;
+    }
+};
+
+// Builds the region_bitset of a sequence (all its regions must belong to the same channel)
+void sequenceRegions(region_sequence &sequence, region_bitset &bitset);
+
+// struct grouping_options
+// Limits of erGroupingNM, the number of pairs grows quadratically with the regions of a
+// channel so cluttered images (foliage, brick, ...) need a cap to bound the grouping time
+// In the anytime mode the pairs are taken best-first and the grouping returns the groups
+// found so far when the time or work budget runs out (the feedback loop is then skipped).
+struct grouping_options
+{
+    int    max_regions;            // max. regions of a channel entering grouping (0 = no limit)
+    float  max_regions_per_mpixel; // same, per megapixel of the channel (0 = no limit)
+    bool   anytime;                // best-first grouping with a time/work budget
+    double max_time;               // time budget (ms) of the whole erGroupingNM call (0 = no limit)
+    int    max_pair_tests;         // work budget, max. pairs tested per channel (0 = no limit)
+    grouping_options() : max_regions(0), max_regions_per_mpixel(0), anytime(false), max_time(0), max_pair_tests(0) {}
+};
+
+// struct grouping_stats
+// What erGroupingNM did with the regions of each channel
+struct grouping_stats
+{
+    vector<int> regions;          // regions given
+    vector<int> region_budget;    // max. regions allowed into grouping (-1 = no limit)
+    vector<int> grouped_regions;  // regions that entered grouping, the rest were dropped
+    vector<unsigned char> completed; // false if the anytime grouping ran out of budget
+    int droppedRegions() const
+    {
+        int dropped = 0;
+        for (size_t c=0; c<regions.size(); c++)
+            dropped += regions[c] - grouped_regions[c];
+        return dropped;
+    }
+};
+
+// Region budget of a channel of the given size (-1 if there is no limit)
+int regionBudget(const grouping_options &options, Size size);
+
+// Chooses the regions of a channel that enter grouping when there are more than budget:
+// the ones that pass the area sanity checks (defined above) first, then by decreasing probability
+// out selected[r] is set for the chosen regions
+// returns the number of selected regions
+int selectRegions(ERStatArena &regions, int budget, vector<unsigned char> &selected);
+
+// Finds the sequences of a channel's regions taking the pairs best-first (anytime mode)
+// in deadline (getTickCount units) and max_pair_tests the budget, 0 = no limit
+// returns false if the search was interrupted by the budget
+bool buildSequencesAnytime(Mat &grey, Mat &lab, Mat &mask, Mat &channel, region_table &table, vector<Vec2i> &all_regions,
+                           vector< vector<int> > &geometric_pairs, int64 deadline, int max_pair_tests,
+                           vector<region_sequence> &valid_sequences);
+
+// Removes a sequence if one its regions is already grouped within a longer sequence
+void removeOverlappingSequences(vector<region_sequence> &valid_sequences);
+
+// Appends a group (its regions, each one once) and its bounding box for every sequence
+void sequencesToGroups(region_table &table, vector<region_sequence> &valid_sequences,
+                       std::vector< std::vector<Vec2i> >& groups, std::vector<Rect>& boxes);
+
 // Takes as input the set of ER's extracted by ERFilter
 // then finds for all valid pairs and triplets.
 // in regions the set of ER's extracted by ERFilter
 // in _src the channels from which the ER's were extracted
+// in options limits of the grouping (e.g. region budget)
 // out sets of regions, each one represents a possible text line
-void erGroupingNM(cv::Mat &img, cv::InputArrayOfArrays _src, std::vector< std::vector<ERStat> >& regions,  std::vector< std::vector<Vec2i> >& groups, std::vector<Rect> &boxes, bool do_feedback_loop);
+// out stats (optional) what was done with the regions of each channel
+void erGroupingNM(cv::Mat &img, cv::InputArrayOfArrays _src, std::vector<ERStatArena>& regions,  std::vector< std::vector<Vec2i> >& groups, std::vector<Rect> &boxes, bool do_feedback_loop,
+                  const grouping_options &options = grouping_options(), grouping_stats *stats = NULL);
+
+// Same as above, taking the grey and Lab images from the frame's ImageContext
+void erGroupingNM(ImageContext &context, cv::InputArrayOfArrays _src, std::vector<ERStatArena>& regions,  std::vector< std::vector<Vec2i> >& groups, std::vector<Rect> &boxes, bool do_feedback_loop,
+                  const grouping_options &options = grouping_options(), grouping_stats *stats = NULL);
+
+// Same as erGroupingNM but for the ER's of a single channel c
+// in grey and lab the grey level and Lab conversions of the input image
+// in deadline end of the time budget of the anytime mode (getTickCount units), 0 = no limit
+// out stats if given, its entries for channel c are filled (they must be allocated)
+void erGroupingNMChannel(cv::Mat &grey, cv::Mat &lab, std::vector<Mat> &src, std::vector<ERStatArena>& regions, size_t c,
+                         std::vector< std::vector<Vec2i> >& groups, std::vector<Rect> &boxes, bool do_feedback_loop,
+                         const grouping_options &options, int64 deadline, grouping_stats *stats);
 
 // Fit line from two points
 // out a0 is the intercept
@@ -188,7 +462,7 @@ float fitLineLMS(Point p1, Point p2, Point p3, float &a0, float &a1);
 
 // Fit a line_estimate to a group of 3 regions
 // out triplet.estimates is updated with the new line estimates
-bool fitLineEstimates(vector< vector<ERStat> > &regions, region_triplet &triplet);
+bool fitLineEstimates(region_table &table, region_triplet &triplet);
 
 // Fit line from two points
 // out a0 is the intercept
@@ -274,12 +548,12 @@ float fitLineLMS(Point p1, Point p2, Point p3, float &a0, float &a1)
 
 // Fit a line_estimate to a group of 3 regions
 // out triplet.estimates is updated with the new line estimates
-bool fitLineEstimates(vector< vector<ERStat> > &regions, region_triplet &triplet)
+bool fitLineEstimates(region_table &table, region_triplet &triplet)
 {
-    vector<Rect> char_boxes;
-    char_boxes.push_back(regions[triplet.a[0]][triplet.a[1]].rect);
-    char_boxes.push_back(regions[triplet.b[0]][triplet.b[1]].rect);
-    char_boxes.push_back(regions[triplet.c[0]][triplet.c[1]].rect);
+    Rect char_boxes[3];
+    char_boxes[0] = table.rect(triplet.a[1]);
+    char_boxes[1] = table.rect(triplet.b[1]);
+    char_boxes[2] = table.rect(triplet.c[1]);
 
     triplet.estimates.x_min = min(min(char_boxes[0].tl().x,char_boxes[1].tl().x), char_boxes[2].tl().x);
     triplet.estimates.x_max = max(max(char_boxes[0].br().x,char_boxes[1].br().x), char_boxes[2].br().x);
@@ -355,91 +629,378 @@ bool fitLineEstimates(vector< vector<ERStat> > &regions, region_triplet &triplet
 }
 
 
-// Evaluates if a pair of regions is valid or not
-// using thresholds learned on training (defined above)
-bool isValidPair(Mat &grey, Mat &lab, Mat &mask, vector<Mat> &channels, std::vector< std::vector<ERStat> >& regions, cv::Vec2i idx1, cv::Vec2i idx2)
+// height octave of a region (index of its pair_index bucket)
+int heightOctave(int height)
 {
-    Rect minarearect  = regions[idx1[0]][idx1[1]].rect | regions[idx2[0]][idx2[1]].rect;
+    int octave = 0;
+    while (height > 1)
+    {
+        height >>= 1;
+        octave++;
+    }
+    return octave;
+}
 
-    // Overlapping regions are not valid pair in any case
-    if ( (minarearect == regions[idx1[0]][idx1[1]].rect) ||
-         (minarearect == regions[idx2[0]][idx2[1]].rect) )
-        return false;
+// Builds the region_table of a channel's regions
+void buildRegionTable(ERStatArena &regions, region_table &table)
+{
+    table = region_table();
+    for (size_t r=0; r<regions.size(); r++)
+        table.push_back(regions[r]);
+}
 
-    ERStat *i, *j;
-    if (regions[idx1[0]][idx1[1]].rect.x < regions[idx2[0]][idx2[1]].rect.x)
+// Region budget of a channel of the given size (-1 if there is no limit)
+int regionBudget(const grouping_options &options, Size size)
+{
+    int budget = -1;
+    if (options.max_regions > 0)
+        budget = options.max_regions;
+    if (options.max_regions_per_mpixel > 0)
     {
-        i = &regions[idx1[0]][idx1[1]];
-        j = &regions[idx2[0]][idx2[1]];
-    } else {
-        i = &regions[idx2[0]][idx2[1]];
-        j = &regions[idx1[0]][idx1[1]];
+        int mpixel_budget = cvFloor(options.max_regions_per_mpixel*size.area()/1e6);
+        budget = (budget < 0) ? mpixel_budget : min(budget, mpixel_budget);
+    }
+    return budget;
+}
+
+// struct region_rank
+// Order in which selectRegions keeps the regions (sane first, then by probability)
+struct region_rank
+{
+    bool  sane;
+    float probability;
+    int   idx;
+    bool operator<(const region_rank& r) const
+    {
+        if (sane != r.sane)
+            return sane;
+        if (probability != r.probability)
+            return probability > r.probability;
+        return idx < r.idx;
+    }
+};
+
+// Chooses the regions of a channel that enter grouping when there are more than budget
+// out selected[r] is set for the chosen regions
+// returns the number of selected regions
+int selectRegions(ERStatArena &regions, int budget, vector<unsigned char> &selected)
+{
+    if ((budget < 0) || ((int)regions.size() <= budget))
+    {
+        selected.assign(regions.size(), 1);
+        return (int)regions.size();
+    }
+
+    vector<region_rank> ranks(regions.size());
+    for (size_t r=0; r<regions.size(); r++)
+    {
+        ERStat &er = regions[r];
+        ranks[r].sane = (er.parent != NULL) && (er.area >= BUDGET_MIN_AREA) &&
+                        (er.area >= BUDGET_MIN_FILL_RATIO*er.rect.area());
+        ranks[r].probability = (float)er.probability;
+        ranks[r].idx = (int)r;
+    }
+    sort(ranks.begin(), ranks.end());
+
+    selected.assign(regions.size(), 0);
+    for (int k=0; k<budget; k++)
+        selected[ranks[k].idx] = 1;
+    return budget;
+}
+
+// Builds the pair_index of a channel's regions (only the selected ones)
+void buildPairIndex(region_table &table, pair_index &index)
+{
+    index.buckets.clear();
+    for (int r=0; r<(int)table.size(); r++)
+    {
+        if (!table.selected[r])
+            continue;
+        int octave = heightOctave(table.height[r]);
+        if (octave >= (int)index.buckets.size())
+            index.buckets.resize(octave+1);
+        index.buckets[octave].regions.push_back(pair<int,int>(table.x[r], r));
+        index.buckets[octave].max_width = max(index.buckets[octave].max_width, table.width[r]);
+    }
+    for (size_t b=0; b<index.buckets.size(); b++)
+        sort(index.buckets[b].regions.begin(), index.buckets[b].regions.end());
+}
+
+// Adds region r to a pair_index
+void addToPairIndex(region_table &table, int r, pair_index &index)
+{
+    int octave = heightOctave(table.height[r]);
+    if (octave >= (int)index.buckets.size())
+        index.buckets.resize(octave+1);
+    pair_index::bucket &bucket = index.buckets[octave];
+    pair<int,int> entry(table.x[r], r);
+    bucket.regions.insert(lower_bound(bucket.regions.begin(), bucket.regions.end(), entry), entry);
+    bucket.max_width = max(bucket.max_width, table.width[r]);
+}
+
+// Removes region r from a pair_index (max_width is kept, it is only an upper bound)
+void removeFromPairIndex(region_table &table, int r, pair_index &index)
+{
+    int octave = heightOctave(table.height[r]);
+    if (octave >= (int)index.buckets.size())
+        return;
+    pair_index::bucket &bucket = index.buckets[octave];
+    pair<int,int> entry(table.x[r], r);
+    vector< pair<int,int> >::iterator it = lower_bound(bucket.regions.begin(), bucket.regions.end(), entry);
+    if ((it != bucket.regions.end()) && (*it == entry))
+        bucket.regions.erase(it);
+}
+
+// Finds the regions j > i that may form a valid pair with region i
+// i.e. a superset of the j's for which isValidPair(i,j) can be true
+// out candidates in ascending order
+void findPairCandidates(region_table &table, pair_index &index, int i, vector<int> &candidates)
+{
+    findPairNeighbours(table, index, i, candidates);
+    candidates.erase(candidates.begin(), upper_bound(candidates.begin(), candidates.end(), i));
+}
+
+// Finds the regions j != i that may form a valid pair with region i
+// out candidates in ascending order
+void findPairNeighbours(region_table &table, pair_index &index, int i, vector<int> &candidates)
+{
+    candidates.clear();
+    const Rect rect = table.rect(i);
+
+    // height_ratio >= PAIR_MIN_HEIGHT_RATIO (0.4) keeps the other region within two octaves
+    int octave = heightOctave(rect.height);
+    int first  = max(0, octave-2);
+    int last   = min((int)index.buckets.size()-1, octave+2);
+
+    for (int b=first; b<=last; b++)
+    {
+        pair_index::bucket &bucket = index.buckets[b];
+        if (bucket.regions.empty())
+            continue;
+
+        // norm_distance <= PAIR_MAX_REGION_DIST with avg_width <= (w_left+w_right)/2 gives
+        // x_right <= x_left + (1+PAIR_MAX_REGION_DIST/2)*w_left + (PAIR_MAX_REGION_DIST/2)*w_right
+        float w_near = 1 + PAIR_MAX_REGION_DIST/2;
+        float w_far  = PAIR_MAX_REGION_DIST/2;
+        int x_from = cvFloor(rect.x - w_near*bucket.max_width - w_far*rect.width) - 1;
+        int x_to   = cvCeil(rect.x + w_near*rect.width + w_far*bucket.max_width) + 1;
+
+        vector< pair<int,int> >::iterator it = lower_bound(bucket.regions.begin(), bucket.regions.end(),
+                                                           pair<int,int>(x_from, INT_MIN));
+        for (; (it != bucket.regions.end()) && (it->first <= x_to); it++)
+        {
+            if (it->second != i)
+                candidates.push_back(it->second);
+        }
     }
 
-    if (j->rect.x == i->rect.x)
+    sort(candidates.begin(), candidates.end());
+}
+
+// Scalar version of the screen in screenPairCandidates, for a single candidate j
+bool screenPairGeometry(region_table &table, int i, int j, float min_slope, float max_slope)
+{
+    if ((table.x[i] == table.x[j]) || table.is_root[j])
         return false;
-    
-    float height_ratio = (float)min(i->rect.height,j->rect.height) /
-                                max(i->rect.height,j->rect.height);
 
-    Point center_i(i->rect.x+i->rect.width/2, i->rect.y+i->rect.height/2);
-    Point center_j(j->rect.x+j->rect.width/2, j->rect.y+j->rect.height/2);
-    float centroid_angle = atan2(center_j.y-center_i.y, center_j.x-center_i.x);
+    int l = (table.x[i] < table.x[j]) ? i : j;
+    int r = (l == i) ? j : i;
 
-    int avg_width = (i->rect.width + j->rect.width) / 2;
-    float norm_distance = (float)(j->rect.x-(i->rect.x+i->rect.width))/avg_width;
+    float h_min = (float)min(table.height[i], table.height[j]);
+    float h_max = (float)max(table.height[i], table.height[j]);
+    if (h_min < (float)(PAIR_MIN_HEIGHT_RATIO-PAIR_SCREEN_TOLERANCE)*h_max)
+        return false;
 
-    if (( height_ratio   < PAIR_MIN_HEIGHT_RATIO) ||
-        ( centroid_angle < PAIR_MIN_CENTROID_ANGLE) ||
-        ( centroid_angle > PAIR_MAX_CENTROID_ANGLE) ||
-        ( norm_distance  < PAIR_MIN_REGION_DIST) ||
-        ( norm_distance  > PAIR_MAX_REGION_DIST))
+    float dx = (float)(table.cx[r]-table.cx[l]);
+    float dy = (float)(table.cy[r]-table.cy[l]);
+    if ((dy > max_slope*dx) || (dy < min_slope*dx))
         return false;
 
-    if ((i->parent == NULL)||(j->parent == NULL)) // deprecate the root region
-      return false;
+    float avg_width = (float)((table.width[i] + table.width[j]) / 2);
+    float gap = (float)(table.x[r]-(table.x[l]+table.width[l]));
+    if ((gap < (float)(PAIR_MIN_REGION_DIST-PAIR_SCREEN_TOLERANCE)*avg_width) ||
+        (gap > (float)(PAIR_MAX_REGION_DIST+PAIR_SCREEN_TOLERANCE)*avg_width))
+        return false;
+
+    return true;
+}
 
-    i = &regions[idx1[0]][idx1[1]];
-    j = &regions[idx2[0]][idx2[1]];
+// Screens a block of candidates for a pair with region i with the geometric checks of isValidPair
+// in/out candidates, only the survivors are kept (in the same order)
+void screenPairCandidates(region_table &table, int i, vector<int> &candidates)
+{
+    if (table.is_root[i]) // the root region is never part of a pair
+    {
+        candidates.clear();
+        return;
+    }
+
+    // atan2(dy,dx) within [MIN_ANGLE,MAX_ANGLE] <=> tan(MIN_ANGLE)*dx <= dy <= tan(MAX_ANGLE)*dx
+    // (this also rejects dx < 0, and dx == 0 unless dy == 0 as atan2(0,0) == 0)
+    float min_slope = (float)(tan(PAIR_MIN_CENTROID_ANGLE) - PAIR_SCREEN_TOLERANCE);
+    float max_slope = (float)(tan(PAIR_MAX_CENTROID_ANGLE) + PAIR_SCREEN_TOLERANCE);
+
+    size_t n = 0, kept = 0;
+#if CV_SSE2
+    const __m128i x_i  = _mm_set1_epi32(table.x[i]);
+    const __m128i w_i  = _mm_set1_epi32(table.width[i]);
+    const __m128i xw_i = _mm_set1_epi32(table.x[i]+table.width[i]);
+    const __m128i cx_i = _mm_set1_epi32(table.cx[i]);
+    const __m128i cy_i = _mm_set1_epi32(table.cy[i]);
+    const __m128  h_i  = _mm_set1_ps((float)table.height[i]);
+    const __m128  sign = _mm_set1_ps(-0.f);
+    const __m128  min_ratio = _mm_set1_ps((float)(PAIR_MIN_HEIGHT_RATIO-PAIR_SCREEN_TOLERANCE));
+    const __m128  min_dist  = _mm_set1_ps((float)(PAIR_MIN_REGION_DIST-PAIR_SCREEN_TOLERANCE));
+    const __m128  max_dist  = _mm_set1_ps((float)(PAIR_MAX_REGION_DIST+PAIR_SCREEN_TOLERANCE));
+    const __m128  v_min_slope = _mm_set1_ps(min_slope);
+    const __m128  v_max_slope = _mm_set1_ps(max_slope);
+
+    int CV_DECL_ALIGNED(16) buf_x[4], buf_w[4], buf_h[4], buf_cx[4], buf_cy[4];
+    for (; n+4 <= candidates.size(); n+=4)
+    {
+        int block[4];
+        for (int k=0; k<4; k++)
+        {
+            int j = block[k] = candidates[n+k];
+            buf_x[k]  = table.x[j];
+            buf_w[k]  = table.width[j];
+            buf_h[k]  = table.height[j];
+            buf_cx[k] = table.cx[j];
+            buf_cy[k] = table.cy[j];
+        }
+        __m128i x_j = _mm_load_si128((const __m128i*)buf_x);
+        __m128i w_j = _mm_load_si128((const __m128i*)buf_w);
+        __m128  h_j = _mm_cvtepi32_ps(_mm_load_si128((const __m128i*)buf_h));
+
+        // i is the left region of the pair in the lanes where x_i < x_j, equal x's are rejected
+        __m128i i_left = _mm_cmplt_epi32(x_i, x_j);
+        __m128  ok = _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(x_i, x_j), _mm_set1_epi32(-1)));
+
+        // height ratio
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(_mm_min_ps(h_i, h_j), _mm_mul_ps(min_ratio, _mm_max_ps(h_i, h_j))));
+
+        // centroid angle, the center differences are negated where j is the left region
+        __m128 flip = _mm_andnot_ps(_mm_castsi128_ps(i_left), sign);
+        __m128 dx = _mm_xor_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_load_si128((const __m128i*)buf_cx), cx_i)), flip);
+        __m128 dy = _mm_xor_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_load_si128((const __m128i*)buf_cy), cy_i)), flip);
+        ok = _mm_and_ps(ok, _mm_cmple_ps(dy, _mm_mul_ps(v_max_slope, dx)));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(dy, _mm_mul_ps(v_min_slope, dx)));
+
+        // region distance normalized by the (integer) average width
+        __m128i gap_i_left = _mm_sub_epi32(x_j, xw_i);
+        __m128i gap_j_left = _mm_sub_epi32(x_i, _mm_add_epi32(x_j, w_j));
+        __m128  gap = _mm_cvtepi32_ps(_mm_or_si128(_mm_and_si128(i_left, gap_i_left), _mm_andnot_si128(i_left, gap_j_left)));
+        __m128  avg_width = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_add_epi32(w_i, w_j), 1));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(gap, _mm_mul_ps(min_dist, avg_width)));
+        ok = _mm_and_ps(ok, _mm_cmple_ps(gap, _mm_mul_ps(max_dist, avg_width)));
+
+        int survivors = _mm_movemask_ps(ok);
+        for (int k=0; k<4; k++)
+            if ((survivors & (1 << k)) && !table.is_root[block[k]])
+                candidates[kept++] = block[k];
+    }
+#endif
+    for (; n<candidates.size(); n++)
+    {
+        int j = candidates[n];
+        if (screenPairGeometry(table, i, j, min_slope, max_slope))
+            candidates[kept++] = j;
+    }
+    candidates.resize(kept);
+}
+
+// Returns the appearance of region idx, measuring it the first time it is requested
+// in channel the channel the regions of table were extracted from
+// in/out mask a CV_8UC1 scratch mask (may be empty), it is grown to the region's rect size + 2
+// when needed, so a worker can reuse it for all the regions it measures
+region_appearance& getRegionAppearance(Mat &grey, Mat &lab, Mat &mask, Mat &channel, region_table &table, int idx)
+{
+    region_appearance &appearance = table.appearance[idx];
+    if (appearance.computed)
+        return appearance;
+
+    Rect er_rect = table.rect(idx);
 
-    Mat region = mask(Rect(Point(i->rect.x,i->rect.y),
-                           Point(i->rect.br().x+2,i->rect.br().y+2)));
+    // floodFill mask of the region's rect, the same one it would use within an image size + 2 mask
+    if ((mask.rows < er_rect.height+2) || (mask.cols < er_rect.width+2))
+        mask.create(max(mask.rows,er_rect.height+2), max(mask.cols,er_rect.width+2), CV_8UC1);
+    Mat region = mask(Rect(0,0,er_rect.width+2,er_rect.height+2));
     region = Scalar(0);
 
     int newMaskVal = 255;
     int flags = 4 + (newMaskVal << 8) + FLOODFILL_FIXED_RANGE + FLOODFILL_MASK_ONLY;
     Rect rect;
 
-    floodFill( channels[idx1[0]](Rect(Point(i->rect.x,i->rect.y),Point(i->rect.br().x,i->rect.br().y))),
-               region, Point(i->pixel%grey.cols - i->rect.x, i->pixel/grey.cols - i->rect.y),
-               Scalar(255), &rect, Scalar(i->level), Scalar(0), flags);
-    rect.width += 2;
-    rect.height += 2;
-    Mat rect_mask = mask(Rect(i->rect.x+1,i->rect.y+1,i->rect.width,i->rect.height));
+    floodFill( channel(er_rect),
+               region, Point(table.pixel[idx]%grey.cols - er_rect.x, table.pixel[idx]/grey.cols - er_rect.y),
+               Scalar(255), &rect, Scalar(table.level[idx]), Scalar(0), flags);
+    Mat rect_mask = region(Rect(1,1,er_rect.width,er_rect.height));
 
     Scalar mean,std;
-    meanStdDev(grey(i->rect),mean,std,rect_mask);
-    int grey_mean1 = mean[0];
-    meanStdDev(lab(i->rect),mean,std,rect_mask);
-    float a_mean1 = mean[1];
-    float b_mean1 = mean[2];
-
-    region = mask(Rect(Point(j->rect.x,j->rect.y),
-                           Point(j->rect.br().x+2,j->rect.br().y+2)));
-    region = Scalar(0);
+    meanStdDev(grey(er_rect),mean,std,rect_mask);
+    appearance.grey_mean = mean[0];
+    meanStdDev(lab(er_rect),mean,std,rect_mask);
+    appearance.a_mean = mean[1];
+    appearance.b_mean = mean[2];
+    appearance.computed = true;
+
+    return appearance;
+}
+
+// Geometric checks of isValidPair
+bool isValidPairGeometry(region_table &table, int idx1, int idx2)
+{
+    Rect rect1 = table.rect(idx1);
+    Rect rect2 = table.rect(idx2);
+    Rect minarearect  = rect1 | rect2;
+
+    // Overlapping regions are not valid pair in any case
+    if ( (minarearect == rect1) || (minarearect == rect2) )
+        return false;
+
+    int i, j;
+    if (table.x[idx1] < table.x[idx2])
+    {
+        i = idx1;
+        j = idx2;
+    } else {
+        i = idx2;
+        j = idx1;
+    }
+
+    if (table.x[j] == table.x[i])
+        return false;
+    
+    float height_ratio = (float)min(table.height[i],table.height[j]) /
+                                max(table.height[i],table.height[j]);
+
+    float centroid_angle = atan2(table.cy[j]-table.cy[i], table.cx[j]-table.cx[i]);
+
+    int avg_width = (table.width[i] + table.width[j]) / 2;
+    float norm_distance = (float)(table.x[j]-(table.x[i]+table.width[i]))/avg_width;
+
+    if (( height_ratio   < PAIR_MIN_HEIGHT_RATIO) ||
+        ( centroid_angle < PAIR_MIN_CENTROID_ANGLE) ||
+        ( centroid_angle > PAIR_MAX_CENTROID_ANGLE) ||
+        ( norm_distance  < PAIR_MIN_REGION_DIST) ||
+        ( norm_distance  > PAIR_MAX_REGION_DIST))
+        return false;
+
+    if (table.is_root[i] || table.is_root[j]) // deprecate the root region
+      return false;
 
-    floodFill( channels[idx2[0]](Rect(Point(j->rect.x,j->rect.y),Point(j->rect.br().x,j->rect.br().y))),
-               region, Point(j->pixel%grey.cols - j->rect.x, j->pixel/grey.cols - j->rect.y),
-               Scalar(255), &rect, Scalar(j->level), Scalar(0), flags);
-    rect.width += 2;
-    rect.height += 2;
-    rect_mask = mask(Rect(j->rect.x+1,j->rect.y+1,j->rect.width,j->rect.height));
+    return true;
+}
 
-    meanStdDev(grey(j->rect),mean,std,rect_mask);
-    int grey_mean2 = mean[0];
-    meanStdDev(lab(j->rect),mean,std,rect_mask);
-    float a_mean2 = mean[1];
-    float b_mean2 = mean[2];
+// Appearance checks of isValidPair
+bool isValidPairAppearance(const region_appearance &appearance1, const region_appearance &appearance2)
+{
+    int   grey_mean1 = appearance1.grey_mean;
+    float a_mean1    = appearance1.a_mean;
+    float b_mean1    = appearance1.b_mean;
+    int   grey_mean2 = appearance2.grey_mean;
+    float a_mean2    = appearance2.a_mean;
+    float b_mean2    = appearance2.b_mean;
 
     if (abs(grey_mean1-grey_mean2) > PAIR_MAX_INTENSITY_DIST)
       return false;
@@ -447,14 +1008,24 @@ bool isValidPair(Mat &grey, Mat &lab, Mat &mask, vector<Mat> &channels, std::vec
     if (sqrt(pow(a_mean1-a_mean2,2)+pow(b_mean1-b_mean2,2)) > PAIR_MAX_AB_DIST)
       return false;
 
+    return true;
+}
 
+// Evaluates if a pair of regions (of the same channel) is valid or not
+// using thresholds learned on training (defined above)
+bool isValidPair(Mat &grey, Mat &lab, Mat &mask, Mat &channel, region_table &table, int idx1, int idx2)
+{
+    if (!isValidPairGeometry(table, idx1, idx2))
+        return false;
 
-    return true;
+    region_appearance appearance1 = getRegionAppearance(grey, lab, mask, channel, table, idx1);
+    region_appearance appearance2 = getRegionAppearance(grey, lab, mask, channel, table, idx2);
+    return isValidPairAppearance(appearance1, appearance2);
 }
 
-// Evaluates if a set of 3 regions is valid or not
+// Evaluates if a set of 3 regions (of the same channel) is valid or not
 // using thresholds learned on training (defined above)
-bool isValidTriplet(std::vector< std::vector<ERStat> >& regions, region_pair pair1, region_pair pair2, region_triplet &triplet)
+bool isValidTriplet(region_table &table, region_pair pair1, region_pair pair2, region_triplet &triplet)
 {
 
     if (pair1 == pair2)
@@ -467,75 +1038,75 @@ bool isValidTriplet(std::vector< std::vector<ERStat> >& regions, region_pair pai
         //fill the indexes in the output tripled (sorted)
         if (pair1.a == pair2.a)
         {
-            if ((regions[pair1.b[0]][pair1.b[1]].rect.x <= regions[pair1.a[0]][pair1.a[1]].rect.x) &&
-                    (regions[pair2.b[0]][pair2.b[1]].rect.x <= regions[pair1.a[0]][pair1.a[1]].rect.x))
+            if ((table.x[pair1.b[1]] <= table.x[pair1.a[1]]) &&
+                    (table.x[pair2.b[1]] <= table.x[pair1.a[1]]))
                 return false;
-            if ((regions[pair1.b[0]][pair1.b[1]].rect.x >= regions[pair1.a[0]][pair1.a[1]].rect.x) &&
-                    (regions[pair2.b[0]][pair2.b[1]].rect.x >= regions[pair1.a[0]][pair1.a[1]].rect.x))
+            if ((table.x[pair1.b[1]] >= table.x[pair1.a[1]]) &&
+                    (table.x[pair2.b[1]] >= table.x[pair1.a[1]]))
                 return false;
 
-            triplet.a = (regions[pair1.b[0]][pair1.b[1]].rect.x <
-                         regions[pair2.b[0]][pair2.b[1]].rect.x)? pair1.b : pair2.b;
+            triplet.a = (table.x[pair1.b[1]] <
+                         table.x[pair2.b[1]])? pair1.b : pair2.b;
             triplet.b = pair1.a;
-            triplet.c = (regions[pair1.b[0]][pair1.b[1]].rect.x >
-                         regions[pair2.b[0]][pair2.b[1]].rect.x)? pair1.b : pair2.b;
+            triplet.c = (table.x[pair1.b[1]] >
+                         table.x[pair2.b[1]])? pair1.b : pair2.b;
 
         } else if (pair1.a == pair2.b) {
-            if ((regions[pair1.b[0]][pair1.b[1]].rect.x <= regions[pair1.a[0]][pair1.a[1]].rect.x) &&
-                    (regions[pair2.a[0]][pair2.a[1]].rect.x <= regions[pair1.a[0]][pair1.a[1]].rect.x))
+            if ((table.x[pair1.b[1]] <= table.x[pair1.a[1]]) &&
+                    (table.x[pair2.a[1]] <= table.x[pair1.a[1]]))
                 return false;
-            if ((regions[pair1.b[0]][pair1.b[1]].rect.x >= regions[pair1.a[0]][pair1.a[1]].rect.x) &&
-                    (regions[pair2.a[0]][pair2.a[1]].rect.x >= regions[pair1.a[0]][pair1.a[1]].rect.x))
+            if ((table.x[pair1.b[1]] >= table.x[pair1.a[1]]) &&
+                    (table.x[pair2.a[1]] >= table.x[pair1.a[1]]))
                 return false;
 
-            triplet.a = (regions[pair1.b[0]][pair1.b[1]].rect.x <
-                         regions[pair2.a[0]][pair2.a[1]].rect.x)? pair1.b : pair2.a;
+            triplet.a = (table.x[pair1.b[1]] <
+                         table.x[pair2.a[1]])? pair1.b : pair2.a;
             triplet.b = pair1.a;
-            triplet.c = (regions[pair1.b[0]][pair1.b[1]].rect.x >
-                         regions[pair2.a[0]][pair2.a[1]].rect.x)? pair1.b : pair2.a;
+            triplet.c = (table.x[pair1.b[1]] >
+                         table.x[pair2.a[1]])? pair1.b : pair2.a;
 
         } else if (pair1.b == pair2.a) {
-            if ((regions[pair1.a[0]][pair1.a[1]].rect.x <= regions[pair1.b[0]][pair1.b[1]].rect.x) &&
-                    (regions[pair2.b[0]][pair2.b[1]].rect.x <= regions[pair1.b[0]][pair1.b[1]].rect.x))
+            if ((table.x[pair1.a[1]] <= table.x[pair1.b[1]]) &&
+                    (table.x[pair2.b[1]] <= table.x[pair1.b[1]]))
                 return false;
-            if ((regions[pair1.a[0]][pair1.a[1]].rect.x >= regions[pair1.b[0]][pair1.b[1]].rect.x) &&
-                    (regions[pair2.b[0]][pair2.b[1]].rect.x >= regions[pair1.b[0]][pair1.b[1]].rect.x))
+            if ((table.x[pair1.a[1]] >= table.x[pair1.b[1]]) &&
+                    (table.x[pair2.b[1]] >= table.x[pair1.b[1]]))
                 return false;
 
-            triplet.a = (regions[pair1.a[0]][pair1.a[1]].rect.x <
-                         regions[pair2.b[0]][pair2.b[1]].rect.x)? pair1.a : pair2.b;
+            triplet.a = (table.x[pair1.a[1]] <
+                         table.x[pair2.b[1]])? pair1.a : pair2.b;
             triplet.b = pair1.b;
-            triplet.c = (regions[pair1.a[0]][pair1.a[1]].rect.x >
-                         regions[pair2.b[0]][pair2.b[1]].rect.x)? pair1.a : pair2.b;
+            triplet.c = (table.x[pair1.a[1]] >
+                         table.x[pair2.b[1]])? pair1.a : pair2.b;
 
         } else if (pair1.b == pair2.b) {
-            if ((regions[pair1.a[0]][pair1.a[1]].rect.x <= regions[pair1.b[0]][pair1.b[1]].rect.x) &&
-                    (regions[pair2.a[0]][pair2.a[1]].rect.x <= regions[pair1.b[0]][pair1.b[1]].rect.x))
+            if ((table.x[pair1.a[1]] <= table.x[pair1.b[1]]) &&
+                    (table.x[pair2.a[1]] <= table.x[pair1.b[1]]))
                 return false;
-            if ((regions[pair1.a[0]][pair1.a[1]].rect.x >= regions[pair1.b[0]][pair1.b[1]].rect.x) &&
-                    (regions[pair2.a[0]][pair2.a[1]].rect.x >= regions[pair1.b[0]][pair1.b[1]].rect.x))
+            if ((table.x[pair1.a[1]] >= table.x[pair1.b[1]]) &&
+                    (table.x[pair2.a[1]] >= table.x[pair1.b[1]]))
                 return false;
 
-            triplet.a = (regions[pair1.a[0]][pair1.a[1]].rect.x <
-                         regions[pair2.a[0]][pair2.a[1]].rect.x)? pair1.a : pair2.a;
+            triplet.a = (table.x[pair1.a[1]] <
+                         table.x[pair2.a[1]])? pair1.a : pair2.a;
             triplet.b = pair1.b;
-            triplet.c = (regions[pair1.a[0]][pair1.a[1]].rect.x >
-                         regions[pair2.a[0]][pair2.a[1]].rect.x)? pair1.a : pair2.a;
+            triplet.c = (table.x[pair1.a[1]] >
+                         table.x[pair2.a[1]])? pair1.a : pair2.a;
 
         }
 
 
 
-        if ( (regions[triplet.a[0]][triplet.a[1]].rect.x == regions[triplet.b[0]][triplet.b[1]].rect.x) &&
-             (regions[triplet.a[0]][triplet.a[1]].rect.x == regions[triplet.c[0]][triplet.c[1]].rect.x) )
+        if ( (table.x[triplet.a[1]] == table.x[triplet.b[1]]) &&
+             (table.x[triplet.a[1]] == table.x[triplet.c[1]]) )
             return false;
 
-        if ( (regions[triplet.a[0]][triplet.a[1]].rect.br().x == regions[triplet.b[0]][triplet.b[1]].rect.br().x) &&
-             (regions[triplet.a[0]][triplet.a[1]].rect.br().x == regions[triplet.c[0]][triplet.c[1]].rect.br().x) )
+        if ( ((table.x[triplet.a[1]]+table.width[triplet.a[1]]) == (table.x[triplet.b[1]]+table.width[triplet.b[1]])) &&
+             ((table.x[triplet.a[1]]+table.width[triplet.a[1]]) == (table.x[triplet.c[1]]+table.width[triplet.c[1]])) )
             return false;
 
 
-        if (!fitLineEstimates(regions, triplet))
+        if (!fitLineEstimates(table, triplet))
             return false;
 
         if ( (triplet.estimates.bottom1_a0 < triplet.estimates.top1_a0) ||
@@ -575,11 +1146,7 @@ bool isValidSequence(region_sequence &sequence1, region_sequence &sequence2)
     {
         for (size_t j=0; j<sequence1.triplets.size(); j++)
         {
-            if ((distanceLinesEstimates(sequence2.triplets[i].estimates,
-                                       sequence1.triplets[j].estimates) < SEQUENCE_MAX_TRIPLET_DIST) &&
-                ((float)max((sequence2.triplets[i].estimates.x_min-sequence1.triplets[j].estimates.x_max),
-                            (sequence1.triplets[j].estimates.x_min-sequence2.triplets[i].estimates.x_max))/
-                        max(sequence2.triplets[i].estimates.h_max,sequence1.triplets[j].estimates.h_max) < 3*PAIR_MAX_REGION_DIST))
+            if (isValidSequence(sequence2.triplets[i], sequence1.triplets[j]))
                 return true;
         }
     }
@@ -587,6 +1154,112 @@ bool isValidSequence(region_sequence &sequence1, region_sequence &sequence2)
     return false;
 }
 
+// Evaluates if two triplets are consistent with being part of the same sequence
+// (two sequences are valid together if any of their triplets are)
+bool isValidSequence(region_triplet &triplet1, region_triplet &triplet2)
+{
+    return ((distanceLinesEstimates(triplet1.estimates, triplet2.estimates) < SEQUENCE_MAX_TRIPLET_DIST) &&
+            ((float)max((triplet1.estimates.x_min-triplet2.estimates.x_max),
+                        (triplet2.estimates.x_min-triplet1.estimates.x_max))/
+                    max(triplet1.estimates.h_max,triplet2.estimates.h_max) < 3*PAIR_MAX_REGION_DIST));
+}
+
+// vertical band covered by the top and bottom lines of a line estimate at x
+void lineEstimatesBand(line_estimates &e, float x, float &y_min, float &y_max)
+{
+    float top1    = e.top1_a0    + x*e.top1_a1;
+    float top2    = e.top2_a0    + x*e.top2_a1;
+    float bottom1 = e.bottom1_a0 + x*e.bottom1_a1;
+    float bottom2 = e.bottom2_a0 + x*e.bottom2_a1;
+    y_min = min(min(top1,top2),min(bottom1,bottom2));
+    y_max = max(max(top1,top2),max(bottom1,bottom2));
+}
+
+// Builds the sequence_index of a set of triplets
+void buildSequenceIndex(vector<region_triplet> &triplets, sequence_index &index)
+{
+    index.buckets.clear();
+    for (int t=0; t<(int)triplets.size(); t++)
+        addToSequenceIndex(triplets, t, index);
+}
+
+// Adds triplet t to a sequence_index
+void addToSequenceIndex(vector<region_triplet> &triplets, int t, sequence_index &index)
+{
+    line_estimates &e = triplets[t].estimates;
+    int octave = heightOctave(e.h_max);
+    if (octave >= (int)index.buckets.size())
+        index.buckets.resize(octave+1);
+    sequence_index::bucket &bucket = index.buckets[octave];
+    bucket.cell_size  = 4 << octave;
+    bucket.max_height = max(bucket.max_height, e.h_max);
+    bucket.max_width  = max(bucket.max_width, e.x_max-e.x_min);
+
+    float y_min, y_max;
+    lineEstimatesBand(e, (e.x_min+e.x_max)/2.f, y_min, y_max);
+    for (int cx=cvFloor((float)e.x_min/bucket.cell_size); cx<=cvFloor((float)e.x_max/bucket.cell_size); cx++)
+        for (int cy=cvFloor(y_min/bucket.cell_size); cy<=cvFloor(y_max/bucket.cell_size); cy++)
+            bucket.cells[pair<int,int>(cx,cy)].push_back(t);
+}
+
+// Finds the triplets that may be consistent with triplet t
+// i.e. a superset of the ones for which isValidSequence(t, other) can be true
+// out candidates in ascending order (t itself may be included)
+void findSequenceCandidates(vector<region_triplet> &triplets, sequence_index &index, int t, vector<int> &candidates)
+{
+    candidates.clear();
+    line_estimates &e = triplets[t].estimates;
+    float x_center = (e.x_min+e.x_max)/2.f;
+    float y_min, y_max;
+    lineEstimatesBand(e, x_center, y_min, y_max);
+
+    // the distance between lines is normalized by the largest h_max, which is not known
+    // in advance, so every bucket is searched with its own bound
+    for (size_t b=0; b<index.buckets.size(); b++)
+    {
+        sequence_index::bucket &bucket = index.buckets[b];
+        if (bucket.cells.empty())
+            continue;
+
+        float h_max  = max(e.h_max, bucket.max_height);
+        // x gap between both triplets below 3*PAIR_MAX_REGION_DIST*h_max
+        float x_dist = 3*PAIR_MAX_REGION_DIST*h_max;
+        // some top (bottom) lines of both must be closer than SEQUENCE_MAX_TRIPLET_DIST*h_max all
+        // along their x-range, slopes are at most TRIPLET_MAX_SLOPE so their bands at the
+        // triplet centres can be this far apart
+        float center_dist = (float)((e.x_max-e.x_min) + bucket.max_width)/2 + x_dist;
+        float y_dist = SEQUENCE_MAX_TRIPLET_DIST*h_max + TRIPLET_MAX_SLOPE*center_dist + 1;
+
+        int cx_from = cvFloor((e.x_min - x_dist - 1)/bucket.cell_size);
+        int cx_to   = cvFloor((e.x_max + x_dist + 1)/bucket.cell_size);
+        int cy_from = cvFloor((y_min - y_dist)/bucket.cell_size);
+        int cy_to   = cvFloor((y_max + y_dist)/bucket.cell_size);
+
+        if ((double)(cx_to-cx_from+1)*(cy_to-cy_from+1) > (double)bucket.cells.size())
+        {
+            // the window covers more cells than the bucket has, visit the ones it has
+            map< pair<int,int>, vector<int> >::iterator it;
+            for (it = bucket.cells.begin(); it != bucket.cells.end(); it++)
+                if ((it->first.first >= cx_from) && (it->first.first <= cx_to) &&
+                    (it->first.second >= cy_from) && (it->first.second <= cy_to))
+                    candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+        else
+        {
+            for (int cx=cx_from; cx<=cx_to; cx++)
+                for (int cy=cy_from; cy<=cy_to; cy++)
+                {
+                    map< pair<int,int>, vector<int> >::iterator it = bucket.cells.find(pair<int,int>(cx,cy));
+                    if (it != bucket.cells.end())
+                        candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+                }
+        }
+    }
+
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
 // Check if two triplets share a region in common
 bool haveCommonRegion(region_triplet &t1, region_triplet &t2)
 {
@@ -613,340 +1286,1236 @@ bool haveCommonRegion(region_sequence &sequence1, region_sequence &sequence2)
     return false;
 }
 
+// Builds the region_bitset of a sequence (all its regions must belong to the same channel)
+void sequenceRegions(region_sequence &sequence, region_bitset &bitset)
+{
+    int r_min = INT_MAX, r_max = -1;
+    for (size_t t=0; t<sequence.triplets.size(); t++)
+    {
+        region_triplet &triplet = sequence.triplets[t];
+        r_min = min(r_min, min(triplet.a[1], min(triplet.b[1], triplet.c[1])));
+        r_max = max(r_max, max(triplet.a[1], max(triplet.b[1], triplet.c[1])));
+    }
+
+    bitset.words.clear();
+    if (r_max < 0)
+        return;
+    bitset.first_word = r_min/64;
+    bitset.words.resize(r_max/64 - bitset.first_word + 1, 0);
+    for (size_t t=0; t<sequence.triplets.size(); t++)
+    {
+        region_triplet &triplet = sequence.triplets[t];
+        bitset.words[triplet.a[1]/64 - bitset.first_word] |= (uint64)1 << (triplet.a[1]%64);
+        bitset.words[triplet.b[1]/64 - bitset.first_word] |= (uint64)1 << (triplet.b[1]%64);
+        bitset.words[triplet.c[1]/64 - bitset.first_word] |= (uint64)1 << (triplet.c[1]%64);
+    }
+}
+
 bool sort_couples (Vec3i i,Vec3i j) { return (i[0]<j[0]); }
 
+//these are the relative area limits of the feedback loop ERFilter (w.r.t. the ROI area)
+#define FEEDBACK_MIN_AREA         0.005
+#define FEEDBACK_MAX_AREA         0.3
 
-// Takes as input the set of ER's extracted by ERFilter
-// then finds for all valid pairs and triplets.
-// in regions the set of ER's extracted by ERFilter
-// in _src the channels from which the ER's were extracted
-// out sets of regions, each one represents a possible text line
-void erGroupingNM(cv::Mat &img, cv::InputArrayOfArrays _src, std::vector< std::vector<ERStat> >& regions,
-                  std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes, bool do_feedback_loop)
+// class ERFeedbackInvoker
+// Extracts the ER's of a range of feedback loop ROIs (see erGroupingNMChannel), each one on
+// its own as the sequential loop did. ERFilter is not reentrant, so every worker creates its
+// own; the ROI is copied into a buffer reused by the worker, because ERFilter needs
+// continuous image data.
+class ERFeedbackInvoker : public ParallelLoopBody
 {
+public:
+    ERFeedbackInvoker(Mat &_src, vector<Rect> &_rois, vector< vector<ERStat> > &_roi_regions)
+        : src(&_src), rois(&_rois), roi_regions(&_roi_regions) {}
 
-    std::vector<Mat> src;
-    _src.getMatVector(src);
+    void operator()(const Range& r) const
+    {
+        Ptr<ERFilter> er_filter = createERFilterNM1(ModelRegistry::instance().classifierNM1(),1,FEEDBACK_MIN_AREA,FEEDBACK_MAX_AREA,0.,true,0.1);
+        Mat buffer;
+        for (int k=r.start; k<r.end; k++)
+        {
+            Rect &rect = (*rois)[k];
+            if ((int)buffer.total() < rect.area())
+                buffer.create(1, rect.area(), CV_8UC1);
+            Mat tmp(rect.height, rect.width, CV_8UC1, buffer.data);
+            (*src)(rect).copyTo(tmp);
 
-    CV_Assert ( !src.empty() );
-    CV_Assert ( src.size() == regions.size() );
+            er_filter->run(tmp, (*roi_regions)[k]);
+        }
+    }
 
-    size_t num_channels = src.size();
+private:
+    Mat *src;
+    vector<Rect> *rois;
+    vector< vector<ERStat> > *roi_regions;
+};
 
-    //process each channel independently
-    for(size_t c=0; c<num_channels; c++)
+// class ERPairGeometryInvoker
+// First pass of the pair search for a range of regions i = rows[k]: the regions j > i that pass
+// the geometric checks of isValidPair, in ascending order. Only reads the table and index.
+// If older is given, the regions j < i that pass them are also collected in older[k] (ascending),
+// except the ones in rows (is_row[j]), whose pairs with i are found from their side.
+class ERPairGeometryInvoker : public ParallelLoopBody
+{
+public:
+    ERPairGeometryInvoker(region_table &_table, pair_index &_index, vector<int> &_rows,
+                          vector< vector<int> > &_geometric_pairs)
+        : table(&_table), index(&_index), rows(&_rows), geometric_pairs(&_geometric_pairs),
+          is_row(NULL), older(NULL) {}
+    ERPairGeometryInvoker(region_table &_table, pair_index &_index, vector<int> &_rows,
+                          vector< vector<int> > &_geometric_pairs, vector<unsigned char> &_is_row,
+                          vector< vector<int> > &_older)
+        : table(&_table), index(&_index), rows(&_rows), geometric_pairs(&_geometric_pairs),
+          is_row(&_is_row), older(&_older) {}
+
+    void operator()(const Range& r) const
     {
-        //store indices to regions in a single vector
-        std::vector< cv::Vec2i > all_regions;
-        for(size_t r=0; r<regions[c].size(); r++)
+        vector<int> candidates;
+        for (int k=r.start; k<r.end; k++)
         {
-            all_regions.push_back(Vec2i(c,r));
+            int i = (*rows)[k];
+            if (older == NULL)
+                findPairCandidates(*table, *index, i, candidates);
+            else
+            {
+                findPairNeighbours(*table, *index, i, candidates);
+                size_t kept = 0;
+                for (size_t n=0; n<candidates.size(); n++)
+                    if ((candidates[n] > i) || !(*is_row)[candidates[n]])
+                        candidates[kept++] = candidates[n];
+                candidates.resize(kept);
+            }
+            screenPairCandidates(*table, i, candidates);
+
+            vector<int> &pairs = (*geometric_pairs)[i];
+            pairs.clear();
+            for (size_t n=0; n<candidates.size(); n++)
+            {
+                int j = candidates[n];
+                if (!isValidPairGeometry(*table, i, j))
+                    continue;
+                if (j > i)
+                    pairs.push_back(j);
+                else
+                    (*older)[k].push_back(j);
+            }
         }
+    }
 
-        std::vector< region_pair > valid_pairs;
-        Mat mask = Mat::zeros(img.rows+2, img.cols+2, CV_8UC1);
-        Mat grey,lab;
-        cvtColor(img, lab, COLOR_RGB2Lab);
-        cvtColor(img, grey, COLOR_RGB2GRAY);
-    
-        //check every possible pair of regions
-        for (size_t i=0; i<all_regions.size(); i++)
+private:
+    region_table *table;
+    pair_index *index;
+    vector<int> *rows;
+    vector< vector<int> > *geometric_pairs;
+    vector<unsigned char> *is_row;
+    vector< vector<int> > *older;
+};
+
+// class ERRegionAppearanceInvoker
+// Measures the appearance of a range of regions (see getRegionAppearance), so that the
+// following pair checks only read the table. Every worker uses its own scratch mask.
+class ERRegionAppearanceInvoker : public ParallelLoopBody
+{
+public:
+    ERRegionAppearanceInvoker(Mat &_grey, Mat &_lab, Mat &_channel, region_table &_table, vector<int> &_idx)
+        : grey(&_grey), lab(&_lab), channel(&_channel), table(&_table), idx(&_idx) {}
+
+    void operator()(const Range& r) const
+    {
+        Mat mask; // grown to the largest region rect measured
+        for (int k=r.start; k<r.end; k++)
+            getRegionAppearance(*grey, *lab, mask, *channel, *table, (*idx)[k]);
+    }
+
+private:
+    Mat *grey;
+    Mat *lab;
+    Mat *channel;
+    region_table *table;
+    vector<int> *idx;
+};
+
+// class ERPairSiblingsInvoker
+// Last pass of the pair search for a range of regions i = rows[k]: checks the appearance of the
+// geometric pairs of i and keeps a single pair (the closer) among the ones whose other
+// regions form a valid pair themselves. The pairs before resolved[i] were checked already
+// (siblings[i] holds their result), the search goes on from there and resolved[i] is moved to
+// the end. The appearance of all the regions involved must have been measured already.
+// out siblings[i] the other region of each pair of i
+class ERPairSiblingsInvoker : public ParallelLoopBody
+{
+public:
+    ERPairSiblingsInvoker(region_table &_table, vector<int> &_rows, vector< vector<int> > &_geometric_pairs,
+                          vector<int> &_resolved, vector< vector<int> > &_siblings)
+        : table(&_table), rows(&_rows), geometric_pairs(&_geometric_pairs), resolved(&_resolved),
+          siblings(&_siblings) {}
+
+    void operator()(const Range& r) const
+    {
+        for (int row=r.start; row<r.end; row++)
         {
-            vector<int> i_siblings;
-            int first_i_sibling_idx = valid_pairs.size();
-            for (size_t j=i+1; j<all_regions.size(); j++)
+            int i = (*rows)[row];
+            vector<int> &i_siblings = (*siblings)[i];
+            vector<int> &pairs = (*geometric_pairs)[i];
+            for (size_t n=(*resolved)[i]; n<pairs.size(); n++)
             {
-                // check height ratio, centroid angle and region distance normalized by region width
-                // fall within a given interval
-                if (isValidPair(grey, lab, mask, src, regions, all_regions[i],all_regions[j]))
+                int j = pairs[n];
+                if (!isValidPairAppearance(table->appearance[i], table->appearance[j]))
+                    continue;
+
+                bool isCycle = false;
+                for (size_t k=0; k<i_siblings.size(); k++)
                 {
-                    bool isCycle = false;
-                    for (size_t k=0; k<i_siblings.size(); k++)
-                    {
-                      if (isValidPair(grey, lab, mask, src, regions, all_regions[j],all_regions[i_siblings[k]]))
-                      {
-                        // choose as sibling the closer and not the first that was "paired" with i
-                        Point i_center = Point( regions[all_regions[i][0]][all_regions[i][1]].rect.x +
-                                                regions[all_regions[i][0]][all_regions[i][1]].rect.width/2,
-                                                regions[all_regions[i][0]][all_regions[i][1]].rect.y +
-                                                regions[all_regions[i][0]][all_regions[i][1]].rect.height/2 );
-                        Point j_center = Point( regions[all_regions[j][0]][all_regions[j][1]].rect.x +
-                                                regions[all_regions[j][0]][all_regions[j][1]].rect.width/2,
-                                                regions[all_regions[j][0]][all_regions[j][1]].rect.y +
-                                                regions[all_regions[j][0]][all_regions[j][1]].rect.height/2 );
-                        Point k_center = Point( regions[all_regions[i_siblings[k]][0]][all_regions[i_siblings[k]][1]].rect.x +
-                                                regions[all_regions[i_siblings[k]][0]][all_regions[i_siblings[k]][1]].rect.width/2,
-                                                regions[all_regions[i_siblings[k]][0]][all_regions[i_siblings[k]][1]].rect.y +
-                                                regions[all_regions[i_siblings[k]][0]][all_regions[i_siblings[k]][1]].rect.height/2 );
-    
-                        if ( norm(i_center - j_center) < norm(i_center - k_center) )
-                        {
-                          valid_pairs[first_i_sibling_idx+k] = region_pair(all_regions[i],all_regions[j]);
-                          i_siblings[k] = j;
-                        }
-                        isCycle = true;
-                        break;
-                      }
-                    }
-                    if (!isCycle)
-                    {
-                      valid_pairs.push_back(region_pair(all_regions[i],all_regions[j]));
-                      i_siblings.push_back(j);
-                      //cout << "Valid pair (" << all_regions[i][0] << ","  << all_regions[i][1] << ") (" << all_regions[j][0] << ","  << all_regions[j][1] << ")" << endl;
-                    }
+                  if (isValidPairGeometry(*table, j, i_siblings[k]) &&
+                      isValidPairAppearance(table->appearance[j], table->appearance[i_siblings[k]]))
+                  {
+                    // choose as sibling the closer and not the first that was "paired" with i
+                    Point i_center = Point( table->cx[i], table->cy[i] );
+                    Point j_center = Point( table->cx[j], table->cy[j] );
+                    Point k_center = Point( table->cx[i_siblings[k]], table->cy[i_siblings[k]] );
+
+                    if ( norm(i_center - j_center) < norm(i_center - k_center) )
+                      i_siblings[k] = j;
+                    isCycle = true;
+                    break;
+                  }
                 }
+                if (!isCycle)
+                  i_siblings.push_back(j);
             }
+            (*resolved)[i] = (int)pairs.size();
         }
-    
-        //cout << "GroupingNM : detected " << valid_pairs.size() << " valid pairs" << endl;
-    
-        std::vector< region_triplet > valid_triplets;
-    
-        //check every possible triplet of regions
-        for (size_t i=0; i<valid_pairs.size(); i++)
+    }
+
+private:
+    region_table *table;
+    vector<int> *rows;
+    vector< vector<int> > *geometric_pairs;
+    vector<int> *resolved;
+    vector< vector<int> > *siblings;
+};
+
+// class ERGrouperNM
+// Stateful exhaustive grouping of the regions of one channel. Regions can be added and removed
+// between calls (e.g. the ones recovered by the feedback loop, or the ones of the next frame of
+// a video) and only what involves them is computed again:
+//  - the geometric pairs of the new regions, and of the older regions they pair with,
+//  - the sibling rule (see ERPairSiblingsInvoker) of a region, from its first pair that changed,
+//  - the triplets of two pairs that were not tried before,
+//  - the consistency (see isValidSequence) of a new triplet with the ones kept.
+// sequences() takes the pairs and triplets in the same order as the exhaustive search always
+// did, so the groups are the ones erGroupingNM gives for the same regions (with no feedback loop).
+// The triplets of the removed regions are dropped from time to time (see compactTriplets).
+class ERGrouperNM
+{
+public:
+    // in grey and lab the grey level and Lab conversions of the input image
+    // in channel the channel the regions were extracted from, c its index
+    // in table the rows of the channel's regions, rows can be appended between calls but not changed
+    ERGrouperNM(Mat &_grey, Mat &_lab, Mat &_channel, region_table &_table, int _c)
+        : grey(&_grey), lab(&_lab), channel(&_channel), table(&_table), c(_c), num_dead(0) {}
+
+    // Groups the regions idx (the ones already grouped are ignored)
+    void addRegions(const vector<int> &idx)
+    {
+        growState();
+
+        vector<int> new_regions;
+        for (size_t n=0; n<idx.size(); n++)
+        {
+            int r = idx[n];
+            CV_Assert( (r >= 0) && (r < (int)table->size()) );
+            if (grouped[r] || marked[r])
+                continue;
+            marked[r] = 1; // new
+            new_regions.push_back(r);
+        }
+        if (new_regions.empty())
+            return;
+        sort(new_regions.begin(), new_regions.end());
+        for (size_t n=0; n<new_regions.size(); n++)
         {
-            for (size_t j=i+1; j<valid_pairs.size(); j++)
+            grouped[new_regions[n]] = 1;
+            addToPairIndex(*table, new_regions[n], index);
+        }
+
+        // the pairs of the new regions are searched in parallel, the older regions they
+        // pair with get the new ones in their (sorted) pairs
+        vector< vector<int> > older(new_regions.size());
+        parallel_for_(Range(0,(int)new_regions.size()),
+                      ERPairGeometryInvoker(*table, index, new_regions, geometric_pairs, marked, older),
+                      max(getNumThreads(),1)*4);
+        for (size_t n=0; n<new_regions.size(); n++)
+        {
+            int r = new_regions[n];
+            marked[r] = 0;
+            resolved[r] = 0;
+            siblings[r].clear();
+            for (size_t k=0; k<older[n].size(); k++)
             {
-                // check colinearity rules
-                region_triplet valid_triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
-                if (isValidTriplet(regions, valid_pairs[i],valid_pairs[j], valid_triplet))
+                int i = older[n][k];
+                vector<int>::iterator it = lower_bound(geometric_pairs[i].begin(), geometric_pairs[i].end(), r);
+                unresolve(i, (int)(it - geometric_pairs[i].begin()));
+                geometric_pairs[i].insert(it, r);
+            }
+        }
+    }
+
+    // Ungroups the regions idx, their pairs and triplets are dropped
+    void removeRegions(const vector<int> &idx)
+    {
+        growState();
+
+        vector<int> candidates;
+        for (size_t n=0; n<idx.size(); n++)
+        {
+            int r = idx[n];
+            if ((r < 0) || (r >= (int)table->size()) || !grouped[r])
+                continue;
+            grouped[r] = 0;
+            removeFromPairIndex(*table, r, index);
+            geometric_pairs[r].clear();
+            siblings[r].clear();
+            resolved[r] = 0;
+
+            // the older regions paired with r
+            findPairNeighbours(*table, index, r, candidates);
+            for (size_t k=0; (k<candidates.size()) && (candidates[k]<r); k++)
+            {
+                int i = candidates[k];
+                vector<int>::iterator it = lower_bound(geometric_pairs[i].begin(), geometric_pairs[i].end(), r);
+                if ((it == geometric_pairs[i].end()) || (*it != r))
+                    continue;
+                unresolve(i, (int)(it - geometric_pairs[i].begin()));
+                geometric_pairs[i].erase(it);
+            }
+
+            for (size_t k=0; k<region_keys[r].size(); k++)
+            {
+                map<triplet_key,int>::iterator it = triplet_ids.find(region_keys[r][k]);
+                if (it == triplet_ids.end())
+                    continue; // already dropped with another of its regions
+                if (it->second >= 0)
                 {
-                    valid_triplets.push_back(valid_triplet);
-                    //cout << "Valid triplet (" << valid_triplet.a[1] << "," <<  valid_triplet.b[1] << "," <<  valid_triplet.c[1] << ")" << endl;
+                    triplet_alive[it->second] = 0;
+                    num_dead++;
                 }
+                triplet_ids.erase(it);
             }
+            region_keys[r].clear();
         }
-    
-        //cout << "GroupingNM : detected " << valid_triplets.size() << " valid triplets" << endl;
-    
-        vector<region_sequence> valid_sequences;
-        vector<region_sequence> pending_sequences;
-    
-        for (size_t i=0; i<valid_triplets.size(); i++)
+
+        if (num_dead > (int)triplets.size()/2)
+            compactTriplets();
+    }
+
+    // Whether region r is grouped
+    bool isGrouped(int r) const
+    {
+        return (r < (int)grouped.size()) && grouped[r];
+    }
+
+    // Finds the grouped regions j that form a valid pair with region r (see isValidPair),
+    // r itself does not have to be grouped
+    // out partners in ascending order
+    void validPairs(int r, vector<int> &partners)
+    {
+        findPairNeighbours(*table, index, r, partners);
+        screenPairCandidates(*table, r, partners);
+        size_t kept = 0;
+        for (size_t n=0; n<partners.size(); n++)
+            if (isValidPair(*grey, *lab, mask, *channel, *table, r, partners[n]))
+                partners[kept++] = partners[n];
+        partners.resize(kept);
+    }
+
+    // Appends the sequences of the grouped regions to valid_sequences, in the order of their
+    // first triplet (as the exhaustive search of erGroupingNM)
+    void sequences(vector<region_sequence> &valid_sequences)
+    {
+        growState();
+        double nstripes = max(getNumThreads(),1)*4;
+
+        // the sibling rule runs (in parallel) on the regions with unresolved pairs, the
+        // regions involved are measured first
+        vector<int> rows, measured;
+        for (int i=0; i<(int)table->size(); i++)
         {
-            pending_sequences.push_back(region_sequence(valid_triplets[i]));
+            if (resolved[i] >= (int)geometric_pairs[i].size())
+                continue;
+            rows.push_back(i);
+            toMeasure(i, measured);
+            for (size_t n=resolved[i]; n<geometric_pairs[i].size(); n++)
+                toMeasure(geometric_pairs[i][n], measured);
         }
-    
-    
-        for (size_t i=0; i<pending_sequences.size(); i++)
+        for (size_t n=0; n<measured.size(); n++)
+            marked[measured[n]] = 0;
+        parallel_for_(Range(0,(int)measured.size()),
+                      ERRegionAppearanceInvoker(*grey, *lab, *channel, *table, measured), max(getNumThreads(),1));
+        parallel_for_(Range(0,(int)rows.size()),
+                      ERPairSiblingsInvoker(*table, rows, geometric_pairs, resolved, siblings), nstripes);
+
+        // the pairs, in i order
+        std::vector< region_pair > valid_pairs;
+        for (int i=0; i<(int)table->size(); i++)
+            for (size_t k=0; k<siblings[i].size(); k++)
+                valid_pairs.push_back(region_pair(Vec2i(c,i),Vec2i(c,siblings[i][k])));
+
+        //check every possible triplet of regions, a triplet needs two pairs with a region in
+        //common so only the pairs adjacent to pair i are tried (in the same order as before)
+        vector<int> order; // the triplets found, by their id
+        vector< vector<int> > region_pairs(table->size());
+        for (size_t p=0; p<valid_pairs.size(); p++)
         {
-            bool expanded = false;
-            for (size_t j=i+1; j<pending_sequences.size(); j++)
+            region_pairs[valid_pairs[p].a[1]].push_back(p);
+            region_pairs[valid_pairs[p].b[1]].push_back(p);
+        }
+        vector<int> adjacent_pairs;
+        for (size_t i=0; i<valid_pairs.size(); i++)
+        {
+            vector<int> &pairs_a = region_pairs[valid_pairs[i].a[1]];
+            vector<int> &pairs_b = region_pairs[valid_pairs[i].b[1]];
+            adjacent_pairs.clear();
+            for (size_t n=0; n<pairs_a.size(); n++)
+                if (pairs_a[n] > (int)i)
+                    adjacent_pairs.push_back(pairs_a[n]);
+            for (size_t n=0; n<pairs_b.size(); n++)
+                if (pairs_b[n] > (int)i)
+                    adjacent_pairs.push_back(pairs_b[n]);
+            sort(adjacent_pairs.begin(), adjacent_pairs.end());
+            adjacent_pairs.erase(unique(adjacent_pairs.begin(), adjacent_pairs.end()), adjacent_pairs.end());
+
+            for (size_t n=0; n<adjacent_pairs.size(); n++)
+            {
+                int t = tripletOf(valid_pairs[i], valid_pairs[adjacent_pairs[n]]);
+                if (t >= 0)
+                    order.push_back(t);
+            }
+        }
+
+        // Every triplet starts as a sequence on its own. In triplet order, each sequence that was not
+        // merged yet absorbs the later ones consistent with any of its triplets, checked in ascending
+        // order (so a triplet can also join through one absorbed before it). A later triplet j joins
+        // sequence i iff some member k<j of i is consistent with it, so taking the candidates from a
+        // min-heap gives the same sequences (and triplet order) as testing all of them one by one.
+        vector<int> position(triplets.size(), -1);
+        for (int n=0; n<(int)order.size(); n++)
+            position[order[n]] = n;
+        disjoint_sets sets(order.size());
+        vector<int> queued(order.size(), -1);
+        for (int i=0; i<(int)order.size(); i++)
+        {
+            if (sets.find(i) != i)
+                continue; // already part of a previous sequence
+
+            priority_queue< int, vector<int>, greater<int> > next;
+            vector<int> absorbed;
+            int k = i;
+            while (true)
             {
-                if (isValidSequence(pending_sequences[i], pending_sequences[j]))
+                vector<int> &edges = consistent[order[k]];
+                for (size_t n=0; n<edges.size(); n++)
                 {
-                    expanded = true;
-                    pending_sequences[i].triplets.insert(pending_sequences[i].triplets.begin(), pending_sequences[j].triplets.begin(), pending_sequences[j].triplets.end());
-                    pending_sequences.erase(pending_sequences.begin()+j);
-                    j--;
+                    int j = position[edges[n]];
+                    if ((j <= k) || (queued[j] == i) || (sets.find(j) != j))
+                        continue;
+                    queued[j] = i;
+                    next.push(j);
                 }
+                if (next.empty())
+                    break;
+                k = next.top();
+                next.pop();
+                sets.unite(i, k);
+                absorbed.push_back(k);
             }
-            if (expanded)
+
+            if (!absorbed.empty())
             {
-                valid_sequences.push_back(pending_sequences[i]);
+                // absorbed triplets were inserted at the front of the sequence
+                region_sequence sequence;
+                for (int n=(int)absorbed.size()-1; n>=0; n--)
+                    sequence.triplets.push_back(triplets[order[absorbed[n]]]);
+                sequence.triplets.push_back(triplets[order[i]]);
+                valid_sequences.push_back(sequence);
             }
         }
-    
-        // remove a sequence if one its regions is already grouped within a longer seq
-        for (size_t i=0; i<valid_sequences.size(); i++)
+    }
+
+    // Appends the groups of the grouped regions and their boxes to out_groups and out_boxes
+    void groups(std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes)
+    {
+        vector<region_sequence> valid_sequences;
+        sequences(valid_sequences);
+        removeOverlappingSequences(valid_sequences);
+        sequencesToGroups(*table, valid_sequences, out_groups, out_boxes);
+    }
+
+private:
+    // the two pairs a triplet was tried with, as (a,b) region indices
+    typedef pair< pair<int,int>, pair<int,int> > triplet_key;
+
+    Mat *grey;
+    Mat *lab;
+    Mat *channel;
+    region_table *table;
+    int c;
+    Mat mask; // scratch for getRegionAppearance
+
+    pair_index index;                       // of the grouped regions
+    vector<unsigned char> grouped;
+    vector<unsigned char> marked;           // scratch flags (e.g. new regions), clear between calls
+    vector< vector<int> > geometric_pairs;  // of each region i, the grouped j > i (ascending)
+    vector<int> resolved;                   // pairs of each region the sibling rule went through
+    vector< vector<int> > siblings;         // of each region, result of the sibling rule
+
+    map<triplet_key,int> triplet_ids;       // triplet found with two pairs, -1 if they form none
+    vector< vector<triplet_key> > region_keys; // the entries of triplet_ids of each region
+    vector<region_triplet> triplets;
+    vector<unsigned char> triplet_alive;
+    vector< vector<int> > consistent;       // triplets consistent with each triplet
+    sequence_index triplet_index;
+    int num_dead;                           // triplets no longer alive
+
+    // Adds the state of the rows appended to the table since the last call (not grouped)
+    void growState()
+    {
+        size_t n = table->size();
+        grouped.resize(n, 0);
+        marked.resize(n, 0);
+        geometric_pairs.resize(n);
+        resolved.resize(n, 0);
+        siblings.resize(n);
+        region_keys.resize(n);
+    }
+
+    // The pairs of region i change from position pos on, its sibling rule must run again from
+    // the start if it went through that position already
+    void unresolve(int i, int pos)
+    {
+        if (pos < resolved[i])
+        {
+            resolved[i] = 0;
+            siblings[i].clear();
+        }
+    }
+
+    // Adds region r to the regions to measure, unless it is measured or added already
+    void toMeasure(int r, vector<int> &measured)
+    {
+        if (table->appearance[r].computed || marked[r])
+            return;
+        marked[r] = 1;
+        measured.push_back(r);
+    }
+
+    // Returns the id of the triplet formed by two valid pairs (see isValidTriplet), or -1
+    int tripletOf(region_pair &pair1, region_pair &pair2)
+    {
+        triplet_key key(pair<int,int>(pair1.a[1],pair1.b[1]), pair<int,int>(pair2.a[1],pair2.b[1]));
+        map<triplet_key,int>::iterator it = triplet_ids.find(key);
+        if (it != triplet_ids.end())
+            return it->second;
+
+        int t = -1;
+        region_triplet valid_triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
+        if (isValidTriplet(*table, pair1, pair2, valid_triplet))
         {
-            for (size_t j=i+1; j<valid_sequences.size(); j++)
+            // the new triplet is consistent with the ones the sequence_index returns
+            t = (int)triplets.size();
+            triplets.push_back(valid_triplet);
+            triplet_alive.push_back(1);
+            consistent.push_back(vector<int>());
+            vector<int> candidates;
+            findSequenceCandidates(triplets, triplet_index, t, candidates);
+            for (size_t n=0; n<candidates.size(); n++)
             {
-              if (haveCommonRegion(valid_sequences[i],valid_sequences[j]))
-              {
-                if (valid_sequences[i].triplets.size() < valid_sequences[j].triplets.size())
+                int u = candidates[n];
+                if ((u != t) && triplet_alive[u] && isValidSequence(triplets[t], triplets[u]))
                 {
-                  valid_sequences.erase(valid_sequences.begin()+i);
-                  i--;
-                  break;
+                    consistent[t].push_back(u);
+                    consistent[u].push_back(t);
                 }
-                else
+            }
+            addToSequenceIndex(triplets, t, triplet_index);
+        }
+
+        triplet_ids[key] = t;
+        region_keys[pair1.a[1]].push_back(key);
+        region_keys[pair1.b[1]].push_back(key);
+        // both pairs have a region in common
+        if ((pair2.a != pair1.a) && (pair2.a != pair1.b))
+            region_keys[pair2.a[1]].push_back(key);
+        if ((pair2.b != pair1.a) && (pair2.b != pair1.b))
+            region_keys[pair2.b[1]].push_back(key);
+        return t;
+    }
+
+    // Drops the triplets that are no longer alive, the others get new (consecutive) ids
+    void compactTriplets()
+    {
+        vector<int> new_id(triplets.size(), -1);
+        vector<region_triplet> kept;
+        for (size_t t=0; t<triplets.size(); t++)
+        {
+            if (!triplet_alive[t])
+                continue;
+            new_id[t] = (int)kept.size();
+            kept.push_back(triplets[t]);
+        }
+
+        vector< vector<int> > kept_consistent(kept.size());
+        for (size_t t=0; t<triplets.size(); t++)
+        {
+            if (new_id[t] < 0)
+                continue;
+            for (size_t n=0; n<consistent[t].size(); n++)
+                if (new_id[consistent[t][n]] >= 0)
+                    kept_consistent[new_id[t]].push_back(new_id[consistent[t][n]]);
+        }
+        for (map<triplet_key,int>::iterator it=triplet_ids.begin(); it!=triplet_ids.end(); it++)
+            if (it->second >= 0)
+                it->second = new_id[it->second];
+
+        triplets.swap(kept);
+        consistent.swap(kept_consistent);
+        triplet_alive.assign(triplets.size(), 1);
+        num_dead = 0;
+        buildSequenceIndex(triplets, triplet_index);
+    }
+};
+
+// Likelihood of a pair used to rank the pairs in the anytime mode: the probabilities of both
+// regions, weighted by how well the geometry of the pair fits a horizontal text line
+float pairLikelihood(region_table &table, int idx1, int idx2)
+{
+    int i = (table.x[idx1] < table.x[idx2]) ? idx1 : idx2;
+    int j = (i == idx1) ? idx2 : idx1;
+
+    float height_ratio = (float)min(table.height[i],table.height[j]) /
+                                max(table.height[i],table.height[j]);
+    float centroid_angle = atan2(table.cy[j]-table.cy[i], table.cx[j]-table.cx[i]);
+    float angle_fit = (centroid_angle > 0) ? 1 - centroid_angle/PAIR_MAX_CENTROID_ANGLE
+                                           : 1 - centroid_angle/PAIR_MIN_CENTROID_ANGLE;
+    int avg_width = (table.width[i] + table.width[j]) / 2;
+    float norm_distance = (float)(table.x[j]-(table.x[i]+table.width[i]))/avg_width;
+    float distance_fit = 1 / (1 + max(norm_distance, 0.f));
+
+    float probability = sqrt(table.probability[i]*table.probability[j]);
+    return (0.5f + 0.5f*probability) * height_ratio * angle_fit * distance_fit;
+}
+
+// struct ranked_pair
+// A candidate pair of the anytime mode, sorted by decreasing likelihood
+struct ranked_pair
+{
+    float likelihood;
+    int i;
+    int j;
+    bool operator<(const ranked_pair& p) const
+    {
+        if (likelihood != p.likelihood)
+            return likelihood > p.likelihood;
+        return (i < p.i) || ((i == p.i) && (j < p.j));
+    }
+};
+
+// Heap order of the ranked pairs: the top of the heap is the first one in ranked_pair order
+struct ranked_pair_after
+{
+    bool operator()(const ranked_pair& p1, const ranked_pair& p2) const { return p2 < p1; }
+};
+
+// Pairs ranked between two checks of the deadline in the anytime mode
+#define ANYTIME_RANKING_CHECK_INTERVAL 256
+
+// Finds the sequences of a channel's regions taking the pairs best-first (by pairLikelihood) and
+// growing triplets and sequences with every accepted pair, until there are no more pairs or the
+// time (deadline, in getTickCount units) or work (pair tests) budget runs out.
+// in mask a scratch mask for the appearance of the regions (see getRegionAppearance)
+// in geometric_pairs[i] the regions j > i that pass the geometric checks of isValidPair with i
+// in deadline and max_pair_tests, 0 = no limit
+// out valid_sequences the sequences found so far, in the order of their first triplet
+// returns false if the search was interrupted by the budget
+bool buildSequencesAnytime(Mat &grey, Mat &lab, Mat &mask, Mat &channel, region_table &table, vector<Vec2i> &all_regions,
+                           vector< vector<int> > &geometric_pairs, int64 deadline, int max_pair_tests,
+                           vector<region_sequence> &valid_sequences)
+{
+    // The pairs are pushed into a heap as they are ranked and taken from it in order, so the
+    // search starts without sorting them all (most are never taken when the budget is tight).
+    // With a pair test budget only the best max_pair_tests pairs are kept. Ranking may take
+    // half of the remaining time at most, then the pairs ranked so far are searched.
+    bool completed = true;
+    bool capped = (max_pair_tests > 0);
+    int64 ranking_deadline = (deadline > 0) ? getTickCount() + (deadline - getTickCount())/2 : 0;
+    vector<ranked_pair> ranked;
+    int num_ranked = 0;
+    for (int i=0; (i<(int)geometric_pairs.size()) && completed; i++)
+    {
+        for (size_t n=0; n<geometric_pairs[i].size(); n++, num_ranked++)
+        {
+            if ((ranking_deadline > 0) && (num_ranked % ANYTIME_RANKING_CHECK_INTERVAL == 0) &&
+                (getTickCount() >= ranking_deadline))
+            {
+                completed = false;
+                break;
+            }
+            ranked_pair p;
+            p.i = i;
+            p.j = geometric_pairs[i][n];
+            p.likelihood = pairLikelihood(table, p.i, p.j);
+            ranked.push_back(p);
+            if (capped)
+            {
+                // worst kept pair on top, dropped when there are more than max_pair_tests
+                push_heap(ranked.begin(), ranked.end());
+                if ((int)ranked.size() > max_pair_tests)
                 {
-                  valid_sequences.erase(valid_sequences.begin()+j);
-                  j--;
+                    pop_heap(ranked.begin(), ranked.end());
+                    ranked.pop_back();
+                    completed = false;
                 }
-              }
             }
+            else
+                push_heap(ranked.begin(), ranked.end(), ranked_pair_after());
+        }
+    }
+    if (capped)
+        make_heap(ranked.begin(), ranked.end(), ranked_pair_after());
+
+    std::vector< region_pair > valid_pairs;
+    vector< vector<int> > region_pairs(table.size()); // accepted pairs of each region
+    std::vector< region_triplet > valid_triplets;
+    sequence_index triplet_index;
+    vector<int> candidates;
+    disjoint_sets sets(0);
+
+    bool interrupted = false;
+    while (!ranked.empty() && !interrupted)
+    {
+        if ((deadline > 0) && (getTickCount() >= deadline))
+        {
+            interrupted = true;
+            break;
         }
-    
-    
-        //cout << "GroupingNM : detected " << valid_sequences.size() << " sequences." << endl;
 
-        if (do_feedback_loop)
+        pop_heap(ranked.begin(), ranked.end(), ranked_pair_after());
+        int i = ranked.back().i;
+        int j = ranked.back().j;
+        ranked.pop_back();
+        if (!isValidPair(grey, lab, mask, channel, table, i, j))
+            continue;
+
+        // as in the exhaustive search, i keeps a single pair among the regions that form a
+        // valid pair themselves, here the first one accepted (the more likely)
+        bool isCycle = false;
+        for (size_t n=0; n<region_pairs[i].size(); n++)
         {
+            region_pair &sibling = valid_pairs[region_pairs[i][n]];
+            int k = (sibling.a[1] == i) ? sibling.b[1] : sibling.a[1];
+            if (isValidPair(grey, lab, mask, channel, table, j, k))
+            {
+                isCycle = true;
+                break;
+            }
+        }
+        if (isCycle)
+            continue;
+
+        int new_pair = (int)valid_pairs.size();
+        valid_pairs.push_back(region_pair(all_regions[i],all_regions[j]));
 
-            //Feedback loop of detected lines to region extraction ... tries to recover missmatches in the region decomposition step by extracting regions in the neighbourhood of a valid sequence and checking if they are consistent with its line estimates
-            Ptr<ERFilter> er_filter = createERFilterNM1(loadClassifierNM1("trained_classifierNM1.xml"),1,0.005,0.3,0.,true,0.1);
-            for (int i=0; i<valid_sequences.size(); i++)
+        // triplets with the accepted pairs adjacent to the new one
+        vector<int> adjacent_pairs(region_pairs[i]);
+        adjacent_pairs.insert(adjacent_pairs.end(), region_pairs[j].begin(), region_pairs[j].end());
+        sort(adjacent_pairs.begin(), adjacent_pairs.end());
+        adjacent_pairs.erase(unique(adjacent_pairs.begin(), adjacent_pairs.end()), adjacent_pairs.end());
+        region_pairs[i].push_back(new_pair);
+        region_pairs[j].push_back(new_pair);
+
+        for (size_t n=0; n<adjacent_pairs.size(); n++)
+        {
+            if ((deadline > 0) && (getTickCount() >= deadline))
             {
-                vector<Point> bbox_points;
+                interrupted = true;
+                break;
+            }
 
-                for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
-                {
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect.tl());
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect.br());
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect.tl());
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect.br());
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect.tl());
-                    bbox_points.push_back(regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect.br());
-                }
+            region_triplet valid_triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
+            if (!isValidTriplet(table, valid_pairs[adjacent_pairs[n]], valid_pairs[new_pair], valid_triplet))
+                continue;
 
-                Rect rect = boundingRect(bbox_points);
-                rect.x = max(rect.x-10,0);
-                rect.y = max(rect.y-10,0);
-                rect.width = min(rect.width+20,src[c].cols-rect.x);
-                rect.height = min(rect.height+20,src[c].rows-rect.y);
+            // the new triplet joins every sequence it is consistent with, only the triplets
+            // the sequence_index returns can be
+            int t = sets.add();
+            valid_triplets.push_back(valid_triplet);
+            findSequenceCandidates(valid_triplets, triplet_index, t, candidates);
+            for (size_t m=0; m<candidates.size(); m++)
+            {
+                int u = candidates[m];
+                if ((u != t) && (sets.find(u) != sets.find(t)) && isValidSequence(valid_triplets[t], valid_triplets[u]))
+                    sets.unite(u, t);
+            }
+            addToSequenceIndex(valid_triplets, t, triplet_index);
+        }
+    }
 
-                vector<ERStat> aux_regions;
-                Mat tmp;
-                src[c](rect).copyTo(tmp);
-                er_filter->run(tmp, aux_regions);
+    // every set of two or more triplets is a sequence
+    vector<int> sequence_of(valid_triplets.size(), -1);
+    vector<region_sequence> sequences;
+    for (int t=0; t<(int)valid_triplets.size(); t++)
+    {
+        int root = sets.find(t);
+        if (sequence_of[root] < 0)
+        {
+            sequence_of[root] = (int)sequences.size();
+            sequences.push_back(region_sequence());
+        }
+        sequences[sequence_of[root]].triplets.push_back(valid_triplets[t]);
+    }
+    for (size_t n=0; n<sequences.size(); n++)
+        if (sequences[n].triplets.size() > 1)
+            valid_sequences.push_back(sequences[n]);
 
-                for(size_t r=0; r<aux_regions.size(); r++)
+    return completed && !interrupted;
+}
+
+// Removes a sequence if one its regions is already grouped within a longer sequence
+// (sequences are marked as removed and compacted at the end, keeping their order)
+void removeOverlappingSequences(vector<region_sequence> &valid_sequences)
+{
+    vector<region_bitset> sequence_regions(valid_sequences.size());
+    for (size_t i=0; i<valid_sequences.size(); i++)
+        sequenceRegions(valid_sequences[i], sequence_regions[i]);
+    vector<bool> removed(valid_sequences.size(), false);
+    for (size_t i=0; i<valid_sequences.size(); i++)
+    {
+        if (removed[i])
+            continue;
+        for (size_t j=i+1; j<valid_sequences.size(); j++)
+        {
+          if (removed[j])
+            continue;
+          if (sequence_regions[i].intersects(sequence_regions[j]))
+          {
+            if (valid_sequences[i].triplets.size() < valid_sequences[j].triplets.size())
+            {
+              removed[i] = true;
+              break;
+            }
+            else
+            {
+              removed[j] = true;
+            }
+          }
+        }
+    }
+    size_t num_sequences = 0;
+    for (size_t i=0; i<valid_sequences.size(); i++)
+    {
+        if (removed[i])
+            continue;
+        if (num_sequences != i)
+            valid_sequences[num_sequences].triplets.swap(valid_sequences[i].triplets);
+        num_sequences++;
+    }
+    valid_sequences.resize(num_sequences);
+}
+
+// Appends a group (its regions, each one once) and its bounding box for every sequence
+void sequencesToGroups(region_table &table, vector<region_sequence> &valid_sequences,
+                       std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes)
+{
+    for (size_t i=0; i<valid_sequences.size(); i++)
+    {
+        vector<Point> bbox_points;
+        vector<Vec2i> group_regions;
+
+        for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
+        {
+            size_t prev_size = group_regions.size();
+            if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].a) == group_regions.end())
+              group_regions.push_back(valid_sequences[i].triplets[j].a);
+            if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].b) == group_regions.end())
+              group_regions.push_back(valid_sequences[i].triplets[j].b);
+            if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].c) == group_regions.end())
+              group_regions.push_back(valid_sequences[i].triplets[j].c);
+
+            for (size_t k=prev_size; k<group_regions.size(); k++)
+            {
+                bbox_points.push_back(table.rect(group_regions[k][1]).tl());
+                bbox_points.push_back(table.rect(group_regions[k][1]).br());
+            }
+        }
+
+        out_groups.push_back(group_regions);
+        out_boxes.push_back(boundingRect(bbox_points));
+        
+    }
+}
+
+// Groups the ER's extracted from a single channel c (see erGroupingNM)
+// in regions the set of ER's extracted by ERFilter, only regions[c] is read and (feedback loop) extended
+// in src the channels from which the ER's were extracted
+// in grey and lab the grey level and Lab conversions of the input image (read only)
+// out the groups and boxes found in channel c are appended to out_groups and out_boxes
+void erGroupingNMChannel(cv::Mat &grey, cv::Mat &lab, std::vector<Mat> &src, std::vector<ERStatArena>& regions, size_t c,
+                         std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes, bool do_feedback_loop,
+                         const grouping_options &options, int64 deadline, grouping_stats *stats)
+{
+    //store indices to regions in a single vector
+    std::vector< cv::Vec2i > all_regions;
+    for(size_t r=0; r<regions[c].size(); r++)
+    {
+        all_regions.push_back(Vec2i(c,r));
+    }
+
+    // geometry of the regions packed in one table, it also caches the grey/Lab means of
+    // each region (measured once and reused for all its pairs)
+    region_table table;
+    buildRegionTable(regions[c], table);
+
+    // on cluttered images only the most promising regions (up to the budget) are grouped
+    int budget = regionBudget(options, src[c].size());
+    int num_selected = selectRegions(regions[c], budget, table.selected);
+    if (stats != NULL)
+    {
+        stats->regions[c]         = (int)regions[c].size();
+        stats->region_budget[c]   = budget;
+        stats->grouped_regions[c] = num_selected;
+    }
+
+    Mat mask; // scratch for getRegionAppearance, grown to the largest region rect
+
+    vector<int> selected_regions;
+    for (int r=0; r<(int)table.size(); r++)
+        if (table.selected[r])
+            selected_regions.push_back(r);
+
+    // the exhaustive grouping keeps its pairs and triplets in a grouper, the regions
+    // recovered by the feedback loop are added to it
+    ERGrouperNM grouper(grey, lab, src[c], table, (int)c);
+
+    vector<region_sequence> valid_sequences;
+    bool completed = true;
+    if (options.anytime)
+    {
+        //check every possible pair of regions, only the neighbours that can pass the
+        //geometric checks are tested (in parallel), then pairs, triplets and sequences
+        //are built from them best-first
+        pair_index index;
+        buildPairIndex(table, index);
+        vector< vector<int> > geometric_pairs(table.size());
+        parallel_for_(Range(0,(int)selected_regions.size()),
+                      ERPairGeometryInvoker(table, index, selected_regions, geometric_pairs), max(getNumThreads(),1)*4);
+        completed = buildSequencesAnytime(grey, lab, mask, src[c], table, all_regions, geometric_pairs,
+                                          deadline, options.max_pair_tests, valid_sequences);
+    }
+    else
+    {
+        grouper.addRegions(selected_regions);
+        grouper.sequences(valid_sequences);
+    }
+    if (stats != NULL)
+        stats->completed[c] = completed;
+
+    // remove a sequence if one its regions is already grouped within a longer seq
+    removeOverlappingSequences(valid_sequences);
+
+
+    //cout << "GroupingNM : detected " << valid_sequences.size() << " sequences." << endl;
+
+    // when the anytime grouping runs out of budget there is no time left for the feedback loop
+    if (do_feedback_loop && completed)
+    {
+
+        //Feedback loop of detected lines to region extraction ... tries to recover missmatches in the region decomposition step by extracting regions in the neighbourhood of a valid sequence and checking if they are consistent with its line estimates
+
+        //The ROI of each sequence does not change while the loop runs, so all of them are
+        //computed first and their regions extracted (in parallel), then every sequence takes
+        //the regions of its ROI. ROIs are not merged, a region must come from the ROI of its
+        //own sequence; one found in several ROIs is added to the channel only once.
+        vector<Rect> sequence_rois(valid_sequences.size());
+        for (int i=0; i<valid_sequences.size(); i++)
+        {
+            vector<Point> bbox_points;
+
+            for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
+            {
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].a[1]).tl());
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].a[1]).br());
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].b[1]).tl());
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].b[1]).br());
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].c[1]).tl());
+                bbox_points.push_back(table.rect(valid_sequences[i].triplets[j].c[1]).br());
+            }
+
+            Rect rect = boundingRect(bbox_points);
+            rect.x = max(rect.x-10,0);
+            rect.y = max(rect.y-10,0);
+            rect.width = min(rect.width+20,src[c].cols-rect.x);
+            rect.height = min(rect.height+20,src[c].rows-rect.y);
+            sequence_rois[i] = rect;
+        }
+
+        vector< vector<ERStat> > roi_regions(sequence_rois.size());
+        parallel_for_(Range(0,(int)sequence_rois.size()), ERFeedbackInvoker(src[c], sequence_rois, roi_regions));
+
+        // regions already added to the channel by the loop, by (seed pixel, level)
+        map< pair<int,int>, vector<int> > recovered;
+
+        // merge the new regions back, one sequence at a time in sequence order
+        for (int i=0; i<valid_sequences.size(); i++)
+        {
+            Rect rect = sequence_rois[i];
+            vector<ERStat> &aux_regions = roi_regions[i];
+
+            for(size_t r=0; r<aux_regions.size(); r++)
+            {
+                if ((aux_regions[r].rect.y == 0)||(aux_regions[r].rect.br().y >= rect.height))
+                  continue;
+
+                aux_regions[r].rect   = aux_regions[r].rect + Point(rect.x,rect.y);
+                aux_regions[r].pixel  = ((aux_regions[r].pixel/rect.width)+rect.y)*src[c].cols + (aux_regions[r].pixel%rect.width) + rect.x;
+                bool overlaps = false;
+                for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
                 {
-                    if ((aux_regions[r].rect.y == 0)||(aux_regions[r].rect.br().y >= tmp.rows))
-                      continue;
+                    Rect minarearect_a  = table.rect(valid_sequences[i].triplets[j].a[1]) | aux_regions[r].rect;
+                    Rect minarearect_b  = table.rect(valid_sequences[i].triplets[j].b[1]) | aux_regions[r].rect;
+                    Rect minarearect_c  = table.rect(valid_sequences[i].triplets[j].c[1]) | aux_regions[r].rect;
+
+                    // Overlapping regions are not valid pair in any case
+                    if ( (minarearect_a == aux_regions[r].rect) ||
+                         (minarearect_b == aux_regions[r].rect) ||
+                         (minarearect_c == aux_regions[r].rect) ||
+                         (minarearect_a == table.rect(valid_sequences[i].triplets[j].a[1])) ||
+                         (minarearect_b == table.rect(valid_sequences[i].triplets[j].b[1])) ||
+                         (minarearect_c == table.rect(valid_sequences[i].triplets[j].c[1])) )
 
-                    aux_regions[r].rect   = aux_regions[r].rect + Point(rect.x,rect.y);
-                    aux_regions[r].pixel  = ((aux_regions[r].pixel/tmp.cols)+rect.y)*src[c].cols + (aux_regions[r].pixel%tmp.cols) + rect.x;
-                    bool overlaps = false;
-                    for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
                     {
-                        Rect minarearect_a  = regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect | aux_regions[r].rect;
-                        Rect minarearect_b  = regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect | aux_regions[r].rect;
-                        Rect minarearect_c  = regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect | aux_regions[r].rect;
-
-                        // Overlapping regions are not valid pair in any case
-                        if ( (minarearect_a == aux_regions[r].rect) ||
-                             (minarearect_b == aux_regions[r].rect) ||
-                             (minarearect_c == aux_regions[r].rect) ||
-                             (minarearect_a == regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect) ||
-                             (minarearect_b == regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect) ||
-                             (minarearect_c == regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect) )
+                        overlaps = true;
+                        break;
+                    }
+                }
+                if (!overlaps)
+                {
+                    //now check if it has at least one valid pair
+                    vector<Vec3i> left_couples, right_couples;
+                    int new_region = -1;
+                    vector<int> &same_seed = recovered[make_pair(aux_regions[r].pixel, aux_regions[r].level)];
+                    for (size_t k=0; k<same_seed.size(); k++)
+                        if (table.rect(same_seed[k]) == aux_regions[r].rect)
+                            new_region = same_seed[k];
+                    if (new_region < 0)
+                    {
+                        regions[c].adopt(aux_regions[r]);
+                        table.push_back(regions[c][regions[c].size()-1]);
+                        new_region = (int)table.size()-1;
+                        same_seed.push_back(new_region);
+                    }
 
-                        {
-                            overlaps = true;
-                            break;
-                        }
+                    // the regions that form a valid pair with the new one: the exhaustive grouping
+                    // finds them with its grouper (which the new region joins), the anytime one
+                    // tests the regions of the sequence
+                    vector<int> partners;
+                    if (!options.anytime)
+                    {
+                        grouper.addRegions(vector<int>(1, new_region));
+                        grouper.validPairs(new_region, partners);
                     }
-                    if (!overlaps)
+                    else
                     {
-                        //now check if it has at least one valid pair
-                        vector<Vec3i> left_couples, right_couples;
-                        regions[c].push_back(aux_regions[r]);
                         for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
                         {
-                            if (isValidPair(grey, lab, mask, src, regions, valid_sequences[i].triplets[j].a, Vec2i(c,regions[c].size()-1)))
-                            {
-                                if (regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect.x > aux_regions[r].rect.x)
-                                    right_couples.push_back(Vec3i(regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect.x - aux_regions[r].rect.x, valid_sequences[i].triplets[j].a[0],valid_sequences[i].triplets[j].a[1]));
-                                else
-                                    left_couples.push_back(Vec3i(aux_regions[r].rect.x - regions[valid_sequences[i].triplets[j].a[0]][valid_sequences[i].triplets[j].a[1]].rect.x, valid_sequences[i].triplets[j].a[0],valid_sequences[i].triplets[j].a[1]));
-                            }
-                            if (isValidPair(grey, lab, mask, src, regions, valid_sequences[i].triplets[j].b, Vec2i(c,regions[c].size()-1)))
-                            {
-                                if (regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect.x > aux_regions[r].rect.x)
-                                    right_couples.push_back(Vec3i(regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect.x - aux_regions[r].rect.x, valid_sequences[i].triplets[j].b[0],valid_sequences[i].triplets[j].b[1]));
-                                else
-                                    left_couples.push_back(Vec3i(aux_regions[r].rect.x - regions[valid_sequences[i].triplets[j].b[0]][valid_sequences[i].triplets[j].b[1]].rect.x, valid_sequences[i].triplets[j].b[0],valid_sequences[i].triplets[j].b[1]));
-                            }
-                            if (isValidPair(grey, lab, mask, src, regions, valid_sequences[i].triplets[j].c, Vec2i(c,regions[c].size()-1)))
-                            {
-                                if (regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect.x > aux_regions[r].rect.x)
-                                    right_couples.push_back(Vec3i(regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect.x - aux_regions[r].rect.x, valid_sequences[i].triplets[j].c[0],valid_sequences[i].triplets[j].c[1]));
-                                else
-                                    left_couples.push_back(Vec3i(aux_regions[r].rect.x - regions[valid_sequences[i].triplets[j].c[0]][valid_sequences[i].triplets[j].c[1]].rect.x, valid_sequences[i].triplets[j].c[0],valid_sequences[i].triplets[j].c[1]));
-                            }
+                            region_triplet &triplet = valid_sequences[i].triplets[j];
+                            int members[3] = { triplet.a[1], triplet.b[1], triplet.c[1] };
+                            for (int m=0; m<3; m++)
+                                if (isValidPair(grey, lab, mask, src[c], table, members[m], new_region))
+                                    partners.push_back(members[m]);
                         }
+                        sort(partners.begin(), partners.end());
+                        partners.erase(unique(partners.begin(), partners.end()), partners.end());
+                    }
 
-                        //make it part of a triplet and check if line estimates is consistent with the sequence
-                        vector<region_triplet> valid_triplets;
-                        if(!left_couples.empty() && !right_couples.empty())
+                    for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
+                    {
+                        if (binary_search(partners.begin(), partners.end(), valid_sequences[i].triplets[j].a[1]))
                         {
-                            sort(left_couples.begin(), left_couples.end(), sort_couples);
-                            sort(right_couples.begin(), right_couples.end(), sort_couples);
-                            region_pair pair1(Vec2i(left_couples[0][1],left_couples[0][2]),Vec2i(c,regions[c].size()-1));
-                            region_pair pair2(Vec2i(c,regions[c].size()-1), Vec2i(right_couples[0][1],right_couples[0][2]));
-                            region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
-                            if (isValidTriplet(regions, pair1, pair2, triplet))
-                            {
-                                valid_triplets.push_back(triplet);
-                            }
+                            if (table.x[valid_sequences[i].triplets[j].a[1]] > aux_regions[r].rect.x)
+                                right_couples.push_back(Vec3i(table.x[valid_sequences[i].triplets[j].a[1]] - aux_regions[r].rect.x, valid_sequences[i].triplets[j].a[0],valid_sequences[i].triplets[j].a[1]));
+                            else
+                                left_couples.push_back(Vec3i(aux_regions[r].rect.x - table.x[valid_sequences[i].triplets[j].a[1]], valid_sequences[i].triplets[j].a[0],valid_sequences[i].triplets[j].a[1]));
                         }
-                        else if (right_couples.size() >= 2)
+                        if (binary_search(partners.begin(), partners.end(), valid_sequences[i].triplets[j].b[1]))
                         {
-                            sort(right_couples.begin(), right_couples.end(), sort_couples);
-                            region_pair pair1(Vec2i(c,regions[c].size()-1), Vec2i(right_couples[0][1],right_couples[0][2]));
-                            region_pair pair2(Vec2i(right_couples[0][1],right_couples[0][2]), Vec2i(right_couples[1][1],right_couples[1][2]));
-                            region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
-                            if (isValidTriplet(regions, pair1, pair2, triplet))
-                            {
-                                valid_triplets.push_back(triplet);
-                            }
+                            if (table.x[valid_sequences[i].triplets[j].b[1]] > aux_regions[r].rect.x)
+                                right_couples.push_back(Vec3i(table.x[valid_sequences[i].triplets[j].b[1]] - aux_regions[r].rect.x, valid_sequences[i].triplets[j].b[0],valid_sequences[i].triplets[j].b[1]));
+                            else
+                                left_couples.push_back(Vec3i(aux_regions[r].rect.x - table.x[valid_sequences[i].triplets[j].b[1]], valid_sequences[i].triplets[j].b[0],valid_sequences[i].triplets[j].b[1]));
                         }
-                        else if (left_couples.size() >=2)
+                        if (binary_search(partners.begin(), partners.end(), valid_sequences[i].triplets[j].c[1]))
                         {
-                            sort(left_couples.begin(), left_couples.end(), sort_couples);
-                            region_pair pair1(Vec2i(left_couples[1][1],left_couples[1][2]), Vec2i(left_couples[0][1],left_couples[0][2]));
-                            region_pair pair2(Vec2i(left_couples[0][1],left_couples[0][2]),Vec2i(c,regions[c].size()-1));
-                            region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
-                            if (isValidTriplet(regions, pair1, pair2, triplet))
-                            {
-                                valid_triplets.push_back(triplet);
-                            }
+                            if (table.x[valid_sequences[i].triplets[j].c[1]] > aux_regions[r].rect.x)
+                                right_couples.push_back(Vec3i(table.x[valid_sequences[i].triplets[j].c[1]] - aux_regions[r].rect.x, valid_sequences[i].triplets[j].c[0],valid_sequences[i].triplets[j].c[1]));
+                            else
+                                left_couples.push_back(Vec3i(aux_regions[r].rect.x - table.x[valid_sequences[i].triplets[j].c[1]], valid_sequences[i].triplets[j].c[0],valid_sequences[i].triplets[j].c[1]));
                         }
-                        else
+                    }
+
+                    //make it part of a triplet and check if line estimates is consistent with the sequence
+                    vector<region_triplet> valid_triplets;
+                    if(!left_couples.empty() && !right_couples.empty())
+                    {
+                        sort(left_couples.begin(), left_couples.end(), sort_couples);
+                        sort(right_couples.begin(), right_couples.end(), sort_couples);
+                        region_pair pair1(Vec2i(left_couples[0][1],left_couples[0][2]),Vec2i(c,new_region));
+                        region_pair pair2(Vec2i(c,new_region), Vec2i(right_couples[0][1],right_couples[0][2]));
+                        region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
+                        if (isValidTriplet(table, pair1, pair2, triplet))
                         {
-                            // no possible triplet found
-                            continue;
+                            valid_triplets.push_back(triplet);
                         }
-
-                        //check if line estimates is consistent with the sequence
-                        for (size_t t=0; t<valid_triplets.size(); t++)
+                    }
+                    else if (right_couples.size() >= 2)
+                    {
+                        sort(right_couples.begin(), right_couples.end(), sort_couples);
+                        region_pair pair1(Vec2i(c,new_region), Vec2i(right_couples[0][1],right_couples[0][2]));
+                        region_pair pair2(Vec2i(right_couples[0][1],right_couples[0][2]), Vec2i(right_couples[1][1],right_couples[1][2]));
+                        region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
+                        if (isValidTriplet(table, pair1, pair2, triplet))
+                        {
+                            valid_triplets.push_back(triplet);
+                        }
+                    }
+                    else if (left_couples.size() >=2)
+                    {
+                        sort(left_couples.begin(), left_couples.end(), sort_couples);
+                        region_pair pair1(Vec2i(left_couples[1][1],left_couples[1][2]), Vec2i(left_couples[0][1],left_couples[0][2]));
+                        region_pair pair2(Vec2i(left_couples[0][1],left_couples[0][2]),Vec2i(c,new_region));
+                        region_triplet triplet(Vec2i(0,0),Vec2i(0,0),Vec2i(0,0));
+                        if (isValidTriplet(table, pair1, pair2, triplet))
                         {
-                            region_sequence sequence(valid_triplets[t]);
-                            if (isValidSequence(valid_sequences[i],sequence))
-                            {
-                                valid_sequences[i].triplets.push_back(valid_triplets[t]);
-                            }
+                            valid_triplets.push_back(triplet);
+                        }
+                    }
+                    else
+                    {
+                        // no possible triplet found
+                        continue;
+                    }
 
+                    //check if line estimates is consistent with the sequence
+                    for (size_t t=0; t<valid_triplets.size(); t++)
+                    {
+                        region_sequence sequence(valid_triplets[t]);
+                        if (isValidSequence(valid_sequences[i],sequence))
+                        {
+                            valid_sequences[i].triplets.push_back(valid_triplets[t]);
                         }
+
                     }
                 }
             }
-
         }
 
-    
-        // Prepare the sequences for output
-        for (size_t i=0; i<valid_sequences.size(); i++)
+    }
+
+
+    // Prepare the sequences for output
+    sequencesToGroups(table, valid_sequences, out_groups, out_boxes);
+}
+
+// class ERGroupingNMInvoker
+// Runs erGroupingNMChannel on a range of channels. Every channel writes its results
+// into its own slot of channel_groups/channel_boxes, they are merged afterwards.
+class ERGroupingNMInvoker : public ParallelLoopBody
+{
+public:
+    ERGroupingNMInvoker(Mat &_grey, Mat &_lab, vector<Mat> &_src, vector<ERStatArena> &_regions,
+                        vector< vector< vector<Vec2i> > > &_channel_groups, vector< vector<Rect> > &_channel_boxes,
+                        bool _do_feedback_loop, const grouping_options &_options, int64 _deadline, grouping_stats *_stats)
+        : grey(&_grey), lab(&_lab), src(&_src), regions(&_regions), channel_groups(&_channel_groups),
+          channel_boxes(&_channel_boxes), do_feedback_loop(_do_feedback_loop), options(&_options),
+          deadline(_deadline), stats(_stats) {}
+
+    void operator()(const Range& r) const
+    {
+        for (int c=r.start; c<r.end; c++)
         {
-            vector<Point> bbox_points;
-            vector<Vec2i> group_regions;
-    
-            for (size_t j=0; j<valid_sequences[i].triplets.size(); j++)
-            {
-                size_t prev_size = group_regions.size();
-                if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].a) == group_regions.end())
-                  group_regions.push_back(valid_sequences[i].triplets[j].a);
-                if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].b) == group_regions.end())
-                  group_regions.push_back(valid_sequences[i].triplets[j].b);
-                if(find(group_regions.begin(), group_regions.end(), valid_sequences[i].triplets[j].c) == group_regions.end())
-                  group_regions.push_back(valid_sequences[i].triplets[j].c);
-    
-                for (size_t k=prev_size; k<group_regions.size(); k++)
-                {
-                    bbox_points.push_back(regions[group_regions[k][0]][group_regions[k][1]].rect.tl());
-                    bbox_points.push_back(regions[group_regions[k][0]][group_regions[k][1]].rect.br());
-                }
-            }
-    
-            out_groups.push_back(group_regions);
-            out_boxes.push_back(boundingRect(bbox_points));
-            
+            erGroupingNMChannel(*grey, *lab, *src, *regions, c, (*channel_groups)[c], (*channel_boxes)[c], do_feedback_loop,
+                                *options, deadline, stats);
         }
     }
 
+private:
+    Mat *grey;
+    Mat *lab;
+    vector<Mat> *src;
+    vector<ERStatArena> *regions;
+    vector< vector< vector<Vec2i> > > *channel_groups;
+    vector< vector<Rect> > *channel_boxes;
+    bool do_feedback_loop;
+    const grouping_options *options;
+    int64 deadline;
+    grouping_stats *stats;
+};
+
+
+// Takes as input the set of ER's extracted by ERFilter
+// then finds for all valid pairs and triplets.
+// in regions the set of ER's extracted by ERFilter
+// in _src the channels from which the ER's were extracted
+// out sets of regions, each one represents a possible text line
+void erGroupingNM(cv::Mat &img, cv::InputArrayOfArrays _src, std::vector<ERStatArena>& regions,
+                  std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes, bool do_feedback_loop,
+                  const grouping_options &options, grouping_stats *stats)
+{
+    ImageContext context(img);
+    erGroupingNM(context, _src, regions, out_groups, out_boxes, do_feedback_loop, options, stats);
+}
+
+// Same as above, taking the grey and Lab images from the frame's ImageContext
+void erGroupingNM(ImageContext &context, cv::InputArrayOfArrays _src, std::vector<ERStatArena>& regions,
+                  std::vector< std::vector<Vec2i> >& out_groups, std::vector<Rect>& out_boxes, bool do_feedback_loop,
+                  const grouping_options &options, grouping_stats *stats)
+{
+    int64 deadline = 0;
+    if (options.anytime && (options.max_time > 0))
+        deadline = getTickCount() + (int64)(options.max_time*getTickFrequency()/1000);
+
+    std::vector<Mat> src;
+    _src.getMatVector(src);
+
+    CV_Assert ( !src.empty() );
+    CV_Assert ( src.size() == regions.size() );
+
+    size_t num_channels = src.size();
+
+    // converted once for all the channels
+    Mat grey = context.grey();
+    Mat lab  = context.lab();
+
+    if (stats != NULL)
+    {
+        stats->regions.assign(num_channels, 0);
+        stats->region_budget.assign(num_channels, -1);
+        stats->grouped_regions.assign(num_channels, 0);
+        stats->completed.assign(num_channels, 1);
+    }
+
+    //process each channel independently (and in parallel)
+    vector< vector< vector<Vec2i> > > channel_groups(num_channels);
+    vector< vector<Rect> > channel_boxes(num_channels);
+    parallel_for_(Range(0,(int)num_channels), ERGroupingNMInvoker(grey, lab, src, regions, channel_groups, channel_boxes,
+                                                                   do_feedback_loop, options, deadline, stats));
+
+    // merge in channel order, so the output is the same as in a sequential run
+    for(size_t c=0; c<num_channels; c++)
+    {
+        out_groups.insert(out_groups.end(), channel_groups[c].begin(), channel_groups[c].end());
+        out_boxes.insert(out_boxes.end(), channel_boxes[c].begin(), channel_boxes[c].end());
+    }
+
 
     //TODO remove this, it is only to visualize for debug
 
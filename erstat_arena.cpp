@@ -0,0 +1,122 @@
+#include "erstat_arena.h"
+
+ERStatArena::ERStatArena(const ERStatArena& other) : count(0)
+{
+  *this = other;
+}
+
+ERStatArena& ERStatArena::operator=(const ERStatArena& other)
+{
+  if (this == &other)
+    return *this;
+
+  clear();
+  for (size_t h=0; h<other.size(); h++)
+    append() = other[h];
+  for (size_t h=0; h<count; h++)
+  {
+    ERStat& er = (*this)[h];
+    ERStat* pointers[] = { er.parent, er.child, er.next, er.prev, er.max_probability_ancestor, er.min_probability_ancestor };
+    long long idx[6];
+    for (int k=0; k<6; k++)
+      idx[k] = other.find(pointers[k]);
+    er.parent                   = (idx[0] < 0) ? er.parent                   : &(*this)[(size_t)idx[0]];
+    er.child                    = (idx[1] < 0) ? er.child                    : &(*this)[(size_t)idx[1]];
+    er.next                     = (idx[2] < 0) ? er.next                     : &(*this)[(size_t)idx[2]];
+    er.prev                     = (idx[3] < 0) ? er.prev                     : &(*this)[(size_t)idx[3]];
+    er.max_probability_ancestor = (idx[4] < 0) ? er.max_probability_ancestor : &(*this)[(size_t)idx[4]];
+    er.min_probability_ancestor = (idx[5] < 0) ? er.min_probability_ancestor : &(*this)[(size_t)idx[5]];
+  }
+  return *this;
+}
+
+ERStatArena::~ERStatArena()
+{
+  for (size_t k=0; k<chunks.size(); k++)
+    delete[] chunks[k];
+}
+
+ERStat& ERStatArena::append()
+{
+  if ((count >> CHUNK_BITS) >= chunks.size())
+  {
+    chunks.push_back(new ERStat[CHUNK_SIZE]);
+    pair<const ERStat*, size_t> entry(chunks.back(), chunks.size()-1);
+    chunks_by_address.insert(upper_bound(chunks_by_address.begin(), chunks_by_address.end(), entry), entry);
+  }
+  count++;
+  return (*this)[count-1];
+}
+
+ERStatArena::handle ERStatArena::push_back(const ERStat& er)
+{
+  append() = er;
+  return (handle)(count-1);
+}
+
+ERStatArena::handle ERStatArena::adopt(const ERStat& er)
+{
+  ERStat& copy = append();
+  copy = er;
+  if (count == 1)
+    copy.parent = NULL;
+  else if (copy.parent != NULL)
+    copy.parent = &(*this)[0];
+  copy.child = copy.next = copy.prev = NULL;
+  copy.max_probability_ancestor = copy.min_probability_ancestor = NULL;
+  return (handle)(count-1);
+}
+
+long long ERStatArena::find(const ERStat* p) const
+{
+  if ((p == NULL) || chunks_by_address.empty())
+    return -1;
+  // last chunk starting at or below p
+  vector< pair<const ERStat*, size_t> >::const_iterator it =
+      upper_bound(chunks_by_address.begin(), chunks_by_address.end(), pair<const ERStat*, size_t>(p, (size_t)-1));
+  if (it == chunks_by_address.begin())
+    return -1;
+  --it;
+  if (p >= it->first + CHUNK_SIZE)
+    return -1;
+  size_t h = (it->second << CHUNK_BITS) + (size_t)(p - it->first);
+  return (h < count) ? (long long)h : -1;
+}
+
+void ERStatArena::assign(const vector<ERStat>& regions)
+{
+  clear();
+  if (regions.empty())
+    return;
+
+  const ERStat* first = &regions[0];
+  const ERStat* last  = first + regions.size();
+  for (size_t i=0; i<regions.size(); i++)
+    append() = regions[i];
+  for (size_t h=0; h<count; h++)
+  {
+    ERStat& er = (*this)[h];
+    ERStat** pointers[] = { &er.parent, &er.child, &er.next, &er.prev, &er.max_probability_ancestor, &er.min_probability_ancestor };
+    for (int k=0; k<6; k++)
+      if ((*pointers[k] >= first) && (*pointers[k] < last))
+        *pointers[k] = &(*this)[*pointers[k] - first];
+  }
+}
+
+void ERStatArena::copyTo(vector<ERStat>& regions) const
+{
+  regions.resize(count);
+  for (size_t h=0; h<count; h++)
+    regions[h] = (*this)[h];
+  for (size_t h=0; h<count; h++)
+  {
+    ERStat& er = regions[h];
+    ERStat** pointers[] = { &er.parent, &er.child, &er.next, &er.prev, &er.max_probability_ancestor, &er.min_probability_ancestor };
+    for (int k=0; k<6; k++)
+    {
+      long long idx = find(*pointers[k]);
+      if (idx >= 0)
+        *pointers[k] = &regions[(size_t)idx];
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef ERSTAT_ARENA_H
+#define ERSTAT_ARENA_H
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// class ERStatArena
+// Append-only storage for the ER's extracted from one channel.
+// ERStat's live in fixed-size chunks that are never relocated, so a region keeps its address
+// and its index (handle) while others are appended, and the tree pointers (parent, child, ...)
+// between regions stay valid. clear() just forgets the regions, chunks are kept for reuse and
+// freed all together with the arena.
+class ERStatArena
+{
+  public:
+    typedef unsigned int handle;
+
+    ERStatArena() : count(0) {}
+    ERStatArena(const ERStatArena& other);
+    ERStatArena& operator=(const ERStatArena& other);
+    ~ERStatArena();
+
+    ERStat& operator[](size_t h) { return chunks[h >> CHUNK_BITS][h & CHUNK_MASK]; }
+    const ERStat& operator[](size_t h) const { return chunks[h >> CHUNK_BITS][h & CHUNK_MASK]; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    //! appends a copy of er, its tree pointers must be NULL or point to regions of this arena
+    handle push_back(const ERStat& er);
+    //! appends a copy of a region that belongs to another tree, it is attached to the root
+    //  region (the first one) and its other tree pointers are cleared. Adopted into an empty
+    //  arena it becomes the root itself (parent NULL)
+    handle adopt(const ERStat& er);
+    //! replaces the contents with a copy of the regions (a tree as given by ERFilter),
+    //  pointers between them are rebased to the copies
+    void assign(const vector<ERStat>& regions);
+    //! copies the regions to a vector (e.g. for erGrouping), pointers between them are rebased
+    void copyTo(vector<ERStat>& regions) const;
+    //! O(1), the chunks are kept for the next regions
+    void clear() { count = 0; }
+
+  private:
+    enum { CHUNK_BITS = 8, CHUNK_SIZE = 1 << CHUNK_BITS, CHUNK_MASK = CHUNK_SIZE-1 };
+
+    //! handle of the region at p, or -1 if p does not point to a region of this arena
+    long long find(const ERStat* p) const;
+    ERStat& append();
+
+    vector<ERStat*> chunks;
+    //! (address, index) of the chunks sorted by address, so find() is a binary search
+    vector< pair<const ERStat*, size_t> > chunks_by_address;
+    size_t count;
+};
+
+#endif
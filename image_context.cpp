@@ -0,0 +1,47 @@
+#include "image_context.h"
+
+ImageContext::ImageContext(const Mat& image) : img(image)
+{
+  CV_Assert( !image.empty() && (image.type() == CV_8UC3) );
+}
+
+const Mat& ImageContext::grey()
+{
+  AutoLock lock(mutex);
+  if (grey_img.empty())
+    cvtColor(img, grey_img, COLOR_RGB2GRAY);
+  return grey_img;
+}
+
+const Mat& ImageContext::invertedGrey()
+{
+  const Mat& g = grey();
+
+  AutoLock lock(mutex);
+  if (inverted_grey_img.empty())
+    inverted_grey_img = 255-g;
+  return inverted_grey_img;
+}
+
+const Mat& ImageContext::lab()
+{
+  AutoLock lock(mutex);
+  if (lab_img.empty())
+    cvtColor(img, lab_img, COLOR_RGB2Lab);
+  return lab_img;
+}
+
+void ImageContext::channels(vector<Mat>& channels)
+{
+  channels.clear();
+  channels.push_back(grey());
+  channels.push_back(invertedGrey());
+}
+
+void ImageContext::release()
+{
+  AutoLock lock(mutex);
+  grey_img.release();
+  inverted_grey_img.release();
+  lab_img.release();
+}
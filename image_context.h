@@ -0,0 +1,50 @@
+#ifndef IMAGE_CONTEXT_H
+#define IMAGE_CONTEXT_H
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// class ImageContext
+// Images derived from one input frame, built once per frame and shared by all the
+// pipeline stages (detection, grouping, segmentation and OCR).
+// Each derived image is computed the first time it is requested, after that it never
+// changes, so the returned references can be read concurrently by any number of threads.
+// All of them are released together with the context (or by release()).
+class ImageContext
+{
+  public:
+    //! image is the (RGB) input frame, it is not copied
+    explicit ImageContext(const Mat& image);
+
+    const Mat& image() const { return img; }
+
+    //! grey level image (COLOR_RGB2GRAY) and its inverse (255-grey)
+    const Mat& grey();
+    const Mat& invertedGrey();
+
+    //! Lab image (COLOR_RGB2Lab)
+    const Mat& lab();
+
+    //! the default channels for region extraction: grey and inverted grey
+    void channels(vector<Mat>& channels);
+
+    //! frees all the derived images, the references returned before become invalid
+    void release();
+
+  private:
+    ImageContext(const ImageContext&);
+    ImageContext& operator=(const ImageContext&);
+
+    Mutex mutex;
+    Mat img;
+    Mat grey_img;
+    Mat inverted_grey_img;
+    Mat lab_img;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "model_registry.h"
+
+ModelRegistry& ModelRegistry::instance()
+{
+  static ModelRegistry registry;
+  return registry;
+}
+
+Ptr<ERFilter::Callback> ModelRegistry::classifierNM1(const string& filename)
+{
+  AutoLock lock(mutex);
+  string key = "NM1:"+filename;
+  map<string, Ptr<ERFilter::Callback> >::iterator it = er_classifiers.find(key);
+  if (it != er_classifiers.end())
+    return it->second;
+
+  Ptr<ERFilter::Callback> cb = loadClassifierNM1(filename);
+  er_classifiers[key] = cb;
+  return cb;
+}
+
+Ptr<ERFilter::Callback> ModelRegistry::classifierNM2(const string& filename)
+{
+  AutoLock lock(mutex);
+  string key = "NM2:"+filename;
+  map<string, Ptr<ERFilter::Callback> >::iterator it = er_classifiers.find(key);
+  if (it != er_classifiers.end())
+    return it->second;
+
+  Ptr<ERFilter::Callback> cb = loadClassifierNM2(filename);
+  er_classifiers[key] = cb;
+  return cb;
+}
+
+Mat ModelRegistry::transitionsOCRHMM(const string& filename)
+{
+  AutoLock lock(mutex);
+  map<string, Mat>::iterator it = tables.find(filename);
+  if (it != tables.end())
+    return it->second.clone();
+
+  Mat transition_p;
+  FileStorage fs(filename, FileStorage::READ);
+  if (!fs.isOpened())
+    CV_Error(CV_StsBadArg, "Transition probabilities file not found!");
+  fs["transition_probabilities"] >> transition_p;
+  fs.release();
+  tables[filename] = transition_p;
+  return transition_p.clone();
+}
+
+Ptr<OCRHMMDecoder::ClassifierCallback> ModelRegistry::classifierKNN(const string& filename)
+{
+  AutoLock lock(mutex);
+  string key = "KNN:"+filename;
+  map<string, Ptr<OCRHMMDecoder::ClassifierCallback> >::iterator it = ocr_classifiers.find(key);
+  if (it != ocr_classifiers.end())
+    return it->second;
+
+  Ptr<OCRHMMDecoder::ClassifierCallback> cb = loadOCRHMMClassifierKNN(filename);
+  ocr_classifiers[key] = cb;
+  return cb;
+}
+
+Ptr<OCRHMMDecoder::ClassifierCallback> ModelRegistry::classifierMLP(const string& filename)
+{
+  AutoLock lock(mutex);
+  string key = "MLP:"+filename;
+  map<string, Ptr<OCRHMMDecoder::ClassifierCallback> >::iterator it = ocr_classifiers.find(key);
+  if (it != ocr_classifiers.end())
+    return it->second;
+
+  Ptr<OCRHMMDecoder::ClassifierCallback> cb = loadOCRHMMClassifierMLP(filename);
+  ocr_classifiers[key] = cb;
+  return cb;
+}
+
+Ptr<OCRLexicon> ModelRegistry::lexicon(const string& filename)
+{
+  AutoLock lock(mutex);
+  map<string, Ptr<OCRLexicon> >::iterator it = lexicons.find(filename);
+  if (it != lexicons.end())
+    return it->second;
+
+  Ptr<OCRLexicon> lex = makePtr<OCRLexicon>(filename);
+  lexicons[filename] = lex;
+  return lex;
+}
@@ -0,0 +1,52 @@
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+
+#include <map>
+#include <string>
+
+#include "ocr_hmm_decoder.h"
+
+using namespace cv;
+using namespace std;
+
+// class ModelRegistry
+// Process-wide cache of the trained models used by the pipeline.
+// Each model file is parsed once, the first time it is requested, and every later
+// request returns the same handle. Handles are shared by all the pipeline stages
+// (and threads), so callers must treat them as read-only.
+class ModelRegistry
+{
+  public:
+    static ModelRegistry& instance();
+
+    //! 1st and 2nd stage ERFilter classifiers (boosted trees)
+    Ptr<ERFilter::Callback> classifierNM1(const string& filename="trained_classifierNM1.xml");
+    Ptr<ERFilter::Callback> classifierNM2(const string& filename="trained_classifierNM2.xml");
+
+    //! character transition probabilities for the OCRHMMDecoder, a copy of the cached
+    //  table (the decoder keeps a reference to it and callers may modify it)
+    Mat transitionsOCRHMM(const string& filename="transitions_OCRHMM.xml");
+
+    //! character classifiers for the OCRHMMDecoder
+    Ptr<OCRHMMDecoder::ClassifierCallback> classifierKNN(const string& filename="ocr_hmm_decoder_train/mlp_mask/knn_model_data.xml");
+    Ptr<OCRHMMDecoder::ClassifierCallback> classifierMLP(const string& filename="ocr_hmm_decoder_train/mlp_mask/trained_mlp.xml");
+
+    //! compiled lexicons for the OCRHMMDecoder (see build_lexicon), mapped read-only
+    Ptr<OCRLexicon> lexicon(const string& filename);
+
+  private:
+    ModelRegistry() {}
+    ModelRegistry(const ModelRegistry&);
+    ModelRegistry& operator=(const ModelRegistry&);
+
+    Mutex mutex;
+    map<string, Ptr<ERFilter::Callback> > er_classifiers;
+    map<string, Ptr<OCRHMMDecoder::ClassifierCallback> > ocr_classifiers;
+    map<string, Mat> tables;
+    map<string, Ptr<OCRLexicon> > lexicons;
+};
+
+#endif
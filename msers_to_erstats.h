@@ -2,10 +2,12 @@
 #include <opencv2/objdetect.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "erstat_arena.h"
+
 using namespace cv;
 using namespace std;
 
-void MSERsToERStats(InputArray image, vector<vector<Point> > &contours, vector<vector<ERStat> > &mser_regions)
+void MSERsToERStats(InputArray image, vector<vector<Point> > &contours, vector<ERStatArena> &mser_regions)
 {
 
   CV_Assert(!contours.empty());
@@ -1,5 +1,183 @@
 #include "ocr_hmm_decoder.h"
 
+#include <limits>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+// log(p), -inf for p <= 0
+double safeLog(double p)
+{
+  return (p > 0) ? log(p) : -numeric_limits<double>::infinity();
+}
+
+// Max-plus product of one Viterbi step, for every state i:
+//   V[i] = max_j (V_prev[j] + log_transition_t[i][j]) + log_emission[i]
+//   backpointers[i] = the first j that reaches the max (0 if all are -inf)
+// N is the number of states when known at compile time (0 for any, given by num_states)
+template<int N>
+void viterbiStep(const double *V_prev, const double *log_transition_t, const double *log_emission,
+                 int num_states, double *V, int *backpointers)
+{
+  const int n = (N > 0) ? N : num_states;
+  const double minus_inf = -numeric_limits<double>::infinity();
+
+  for (int i=0; i<n; i++)
+  {
+    // an impossible emission makes all the paths to i impossible
+    if (log_emission[i] == minus_inf)
+    {
+      V[i] = minus_inf;
+      backpointers[i] = 0;
+      continue;
+    }
+
+    const double *row = log_transition_t + i*n;
+    double max_prob = minus_inf;
+    int best_idx = 0;
+    int j = 0;
+#if CV_SSE2
+    // two lanes, each one keeps its own max and first argmax (as a double)
+    __m128d v_max = _mm_set1_pd(minus_inf);
+    __m128d v_idx = _mm_setzero_pd();
+    __m128d v_j   = _mm_set_pd(1., 0.);
+    const __m128d v_two = _mm_set1_pd(2.);
+    for (; j+2 <= n; j+=2)
+    {
+      __m128d prob = _mm_add_pd(_mm_loadu_pd(V_prev+j), _mm_loadu_pd(row+j));
+      __m128d gt   = _mm_cmpgt_pd(prob, v_max);
+      v_max = _mm_or_pd(_mm_and_pd(gt, prob), _mm_andnot_pd(gt, v_max));
+      v_idx = _mm_or_pd(_mm_and_pd(gt, v_j), _mm_andnot_pd(gt, v_idx));
+      v_j   = _mm_add_pd(v_j, v_two);
+    }
+    double CV_DECL_ALIGNED(16) lane_max[2], lane_idx[2];
+    _mm_store_pd(lane_max, v_max);
+    _mm_store_pd(lane_idx, v_idx);
+    for (int k=0; k<2; k++)
+    {
+      if ((lane_max[k] > max_prob) || ((lane_max[k] == max_prob) && (lane_max[k] > minus_inf) && ((int)lane_idx[k] < best_idx)))
+      {
+        max_prob = lane_max[k];
+        best_idx = (int)lane_idx[k];
+      }
+    }
+#endif
+    for (; j<n; j++)
+    {
+      double prob = V_prev[j] + row[j];
+      if (prob > max_prob)
+      {
+        max_prob = prob;
+        best_idx = j;
+      }
+    }
+
+    V[i] = max_prob + log_emission[i];
+    backpointers[i] = best_idx;
+  }
+}
+
+// Pruned Viterbi step, only from the active states at t-1 (prev_states, ascending) into the
+// active states at t (states). Same as viterbiStep for these, the rest of V is set to -inf
+// (and their backpointers to 0)
+void viterbiStepPruned(const double *V_prev, const int *prev_states, int num_prev_states,
+                       const double *log_transition_t, const double *log_emission, int num_states,
+                       const int *states, int num_active, double *V, int *backpointers)
+{
+  const double minus_inf = -numeric_limits<double>::infinity();
+  for (int i=0; i<num_states; i++)
+  {
+    V[i] = minus_inf;
+    backpointers[i] = 0;
+  }
+
+  for (int n=0; n<num_active; n++)
+  {
+    int i = states[n];
+    const double *row = log_transition_t + i*num_states;
+    double max_prob = minus_inf;
+    int best_idx = 0;
+    for (int k=0; k<num_prev_states; k++)
+    {
+      int j = prev_states[k];
+      double prob = V_prev[j] + row[j];
+      if (prob > max_prob)
+      {
+        max_prob = prob;
+        best_idx = j;
+      }
+    }
+    V[i] = max_prob + log_emission[i];
+    backpointers[i] = best_idx;
+  }
+}
+
+// struct emission_greater
+// Orders states by decreasing emission probability (the lower state first on ties)
+struct emission_greater
+{
+  const double *log_emission;
+  emission_greater(const double *_log_emission) : log_emission(_log_emission) {}
+  bool operator()(int a, int b) const
+  {
+    if (log_emission[a] != log_emission[b])
+      return log_emission[a] > log_emission[b];
+    return a < b;
+  }
+};
+
+// struct hypothesis_order
+// Orders the lexicon hypotheses by (node, last character), the best one first
+struct hypothesis_order
+{
+  bool operator()(const lexicon_hypothesis &a, const lexicon_hypothesis &b) const
+  {
+    if (a.node != b.node)
+      return a.node < b.node;
+    if (a.label != b.label)
+      return a.label < b.label;
+    if (a.score != b.score)
+      return a.score > b.score;
+    return a.prev < b.prev;
+  }
+};
+
+// Selects the (at most) top_k states with the highest emission probability, the impossible
+// ones are never selected
+// in order a num_states scratch vector
+// out states the selected states in ascending order, returns how many
+int topEmissionStates(const double *log_emission, int num_states, int top_k, vector<int> &order, int *states)
+{
+  order.resize(num_states);
+  for (int i=0; i<num_states; i++)
+    order[i] = i;
+  int k = min(top_k, num_states);
+  partial_sort(order.begin(), order.begin()+k, order.end(), emission_greater(log_emission));
+
+  int num_active = 0;
+  for (int n=0; n<k; n++)
+    if (log_emission[order[n]] > -numeric_limits<double>::infinity())
+      states[num_active++] = order[n];
+  sort(states, states+num_active);
+  return num_active;
+}
+
+// Drops the active states whose score in V is more than beam below the best one
+// in/out states the active states (ascending, kept in order), returns how many are left
+int beamPruneStates(const double *V, double beam, int *states, int num_active)
+{
+  double max_prob = -numeric_limits<double>::infinity();
+  for (int n=0; n<num_active; n++)
+    max_prob = max(max_prob, V[states[n]]);
+
+  int kept = 0;
+  for (int n=0; n<num_active; n++)
+    if (V[states[n]] >= max_prob - beam)
+      states[kept++] = states[n];
+  return kept;
+}
+
 //Default constructor
 OCRHMMDecoder::OCRHMMDecoder( Ptr<OCRHMMDecoder::ClassifierCallback> _classifier,
                    string& _vocabulary,
@@ -12,56 +190,114 @@ OCRHMMDecoder::OCRHMMDecoder( Ptr<OCRHMMDecoder::ClassifierCallback> _classifier
   emission_p = emission_probabilities_table.getMat();
   vocabulary = _vocabulary;
   mode = _mode;
+  top_k = 0;
+  beam = 0;
+
+  // Viterbi runs in log space over the transposed transition table: row i holds
+  // log(transition_p(j,i)) for all j, contiguous for the max-plus kernel
+  int num_states = (int)vocabulary.size();
+  CV_Assert( (transition_p.type() == CV_64FC1) &&
+             (transition_p.rows == num_states) && (transition_p.cols == num_states) );
+  CV_Assert( (emission_p.type() == CV_64FC1) &&
+             (emission_p.rows == num_states) && (emission_p.cols == num_states) );
+  log_transition_t.create(num_states, num_states, CV_64FC1);
+  for (int i=0; i<num_states; i++)
+    for (int j=0; j<num_states; j++)
+      log_transition_t.at<double>(i,j) = safeLog(transition_p.at<double>(j,i));
 }
 
 OCRHMMDecoder::~OCRHMMDecoder()
 {
 }
 
+void OCRHMMDecoder::setPruning(int _top_k, double _beam)
+{
+  top_k = _top_k;
+  beam = _beam;
+}
+
+void OCRHMMDecoder::setLexicon(const Ptr<OCRLexicon>& _lexicon)
+{
+  if (!_lexicon.empty())
+    CV_Assert( _lexicon->vocabulary() == vocabulary );
+  lexicon = _lexicon;
+}
+
 bool sort_rect_horiz (Rect a,Rect b) { return (a.x<b.x); }
 
+// Copies img into a view of buffer (grown to fit it when needed) and returns the view
+Mat copyToScratch(const Mat &img, Mat &buffer)
+{
+  if ((buffer.rows < img.rows) || (buffer.cols < img.cols) || (buffer.type() != img.type()))
+    buffer.create(max(buffer.rows,img.rows), max(buffer.cols,img.cols), img.type());
+  Mat view = buffer(Rect(0,0,img.cols,img.rows));
+  img.copyTo(view);
+  return view;
+}
+
 double OCRHMMDecoder::run( InputArray src,
               InputArray mask,
               string& out_sequence,
 	            vector<Rect>* component_rects, 
               vector<string>* component_texts, 
               vector<float>* component_confidences,
-              int component_level)
+              int component_level) const
 {
+  Workspace workspace;
+  return run(src, mask, out_sequence, workspace, component_rects, component_texts,
+             component_confidences, component_level);
+}
 
-  out_sequence.clear();
-  component_rects->clear();
-  component_texts->clear();
-  component_confidences->clear();
+double OCRHMMDecoder::run( InputArray src,
+              InputArray mask,
+              string& out_sequence,
+              Workspace& workspace,
+	            vector<Rect>* component_rects, 
+              vector<string>* component_texts, 
+              vector<float>* component_confidences,
+              int component_level) const
+{
 
-  // First we split a line into words (TODO this must be optional)
-  vector<Mat> words_mask;
-  vector<Mat> words_src;
-  vector<Rect> words_rect;
+  out_sequence.clear();
+  if (component_rects != NULL)
+    component_rects->clear();
+  if (component_texts != NULL)
+    component_texts->clear();
+  if (component_confidences != NULL)
+    component_confidences->clear();
+
+  // First we split a line into words (TODO this must be optional), the words are
+  // views of src and mask at words_rect
+  Mat src_img  = src.getMat();
+  Mat mask_img = mask.getMat();
+  vector<Rect> &words_rect = workspace.words_rect;
+  words_rect.clear();
 
   /// Find contours
-  vector<vector<Point> > contours;
-  vector<Vec4i> hierarchy;
-  Mat tmp;
-  mask.getMat().copyTo(tmp);
-  findContours( tmp, contours, hierarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(0, 0) );
+  vector<vector<Point> > &contours = workspace.contours;
+  vector<Vec4i> &hierarchy = workspace.hierarchy;
+  Mat contours_img = copyToScratch(mask_img, workspace.contours_img);
+  findContours( contours_img, contours, hierarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(0, 0) );
   if (contours.size() < 6)
   {
     //do not split lines with less than 6 characters
-    words_mask.push_back(mask.getMat());
-    words_src.push_back(src.getMat());
-    words_rect.push_back(Rect(0,0,mask.getMat().cols,mask.getMat().rows));
+    words_rect.push_back(Rect(0,0,mask_img.cols,mask_img.rows));
   }
   else
   {
 
 
-        Mat_<float> vector_w((int)mask.getMat().cols,1);
-        reduce(mask.getMat(), vector_w, 0, CV_REDUCE_SUM, -1);
+        if (workspace.column_sums.size() < (size_t)mask_img.cols)
+          workspace.column_sums.resize(mask_img.cols);
+        Mat vector_w(1, mask_img.cols, CV_32F, &workspace.column_sums[0]);
+        reduce(mask_img, vector_w, 0, CV_REDUCE_SUM, CV_32F);
 
-        vector<int> spaces;
-        vector<int> spaces_start;
-        vector<int> spaces_end;
+        vector<int> &spaces = workspace.spaces;
+        vector<int> &spaces_start = workspace.spaces_start;
+        vector<int> &spaces_end = workspace.spaces_end;
+        spaces.clear();
+        spaces_start.clear();
+        spaces_end.clear();
         int space_count=0;
         int last_one_idx;
         for (int s=0; s<vector_w.cols; s++)
@@ -91,57 +327,39 @@ double OCRHMMDecoder::run( InputArray src,
                 if (num_word_spaces == 0)
                 {
                     //cout << " we have a word from  0  to " << spaces_start.at(s) << endl;
-                    Mat word_mask, word_src;
-                    Rect word_rect = Rect(0,0,spaces_start.at(s),mask.getMat().rows);
-                    mask.getMat()(word_rect).copyTo(word_mask);
-                    src.getMat()(word_rect).copyTo(word_src);
-
-                    words_mask.push_back(word_mask);
-                    words_src.push_back(word_src);
-                    words_rect.push_back(word_rect);
+                    words_rect.push_back(Rect(0,0,spaces_start.at(s),mask_img.rows));
                 }
                 else
                 {
                     //cout << " we have a word from " << last_word_space_end << " to " << spaces_start.at(s) << endl;
-                    Mat word_mask, word_src;
-                    Rect word_rect = Rect(last_word_space_end,0,spaces_start.at(s)-last_word_space_end,mask.getMat().rows);
-                    mask.getMat()(word_rect).copyTo(word_mask);
-                    src.getMat()(word_rect).copyTo(word_src);
-
-                    words_mask.push_back(word_mask);
-                    words_src.push_back(word_src);
-                    words_rect.push_back(word_rect);
+                    words_rect.push_back(Rect(last_word_space_end,0,spaces_start.at(s)-last_word_space_end,mask_img.rows));
                 }
                 num_word_spaces++;
                 last_word_space_end = spaces_end.at(s);
             }
         }
         //cout << " we have a word from " << last_word_space_end << " to " << vector_w.cols << endl << endl << endl;
-                    Mat word_mask, word_src;
-                    Rect word_rect = Rect(last_word_space_end,0,vector_w.cols-last_word_space_end,mask.getMat().rows);
-                    mask.getMat()(word_rect).copyTo(word_mask);
-                    src.getMat()(word_rect).copyTo(word_src);
-
-                    words_mask.push_back(word_mask);
-                    words_src.push_back(word_src);
-                    words_rect.push_back(word_rect);
+                    words_rect.push_back(Rect(last_word_space_end,0,vector_w.cols-last_word_space_end,mask_img.rows));
 
   }
 
-  for (int w=0; w<words_mask.size(); w++)
+  for (int w=0; w<words_rect.size(); w++)
   {
 
-  vector< vector<int> > observations;
-  vector< vector<double> > confidences;
-  vector<int> obs;
+  Mat word_src  = src_img(words_rect[w]);
+  Mat word_mask = mask_img(words_rect[w]);
+
+  // observations and confidences keep their capacity from word to word (eval clears them)
+  vector< vector<int> > &observations = workspace.observations;
+  vector< vector<double> > &confidences = workspace.confidences;
+  vector<int> &obs = workspace.obs;
+  obs.clear();
   // First find contours and sort by x coordinate of bbox
-  Mat tmp;
-  words_mask[w].copyTo(tmp);
-  vector<vector<Point> > contours;
-  vector<Vec4i> hierarchy;
+  contours_img = copyToScratch(word_mask, workspace.contours_img);
   /// Find contours
-  findContours( tmp, contours, hierarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(0, 0) );
-  vector<Rect> contours_rect;
+  findContours( contours_img, contours, hierarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(0, 0) );
+  vector<Rect> &contours_rect = workspace.contours_rect;
+  contours_rect.clear();
   for (int i=0; i<contours.size(); i++)
   {
     contours_rect.push_back(boundingRect(contours[i]));
@@ -149,103 +367,301 @@ double OCRHMMDecoder::run( InputArray src,
 
   sort(contours_rect.begin(), contours_rect.end(), sort_rect_horiz);
   
-  // Do character recognition foreach contour 
+  // Do character recognition foreach contour (the classifier only reads its inputs, so
+  // it gets views of the word images)
+  if (observations.size() < contours.size())
+  {
+    observations.resize(contours.size());
+    confidences.resize(contours.size());
+  }
   for (int i=0; i<contours.size(); i++)
   {
-    Mat tmp_src;
-    Mat tmp_mask;
-    words_src[w](contours_rect.at(i)).copyTo(tmp_src);
-    words_mask[w](contours_rect.at(i)).copyTo(tmp_mask);
+    classifier->eval(word_src(contours_rect.at(i)),word_mask(contours_rect.at(i)),
+                     observations[i],confidences[i]);
+    if (!observations[i].empty())
+      obs.push_back(observations[i][0]);
+  }
+
+  // no character recognized in this word
+  if (obs.empty())
+    continue;
+
+
+  // With a lexicon the word is the most likely lexicon word of its length, when no
+  // lexicon word fits the observations it is decoded unconstrained
+  string &best_path = workspace.best_path;
+  double max_log_prob;
+  if (lexicon.empty() || !decodeLexicon(workspace, best_path, max_log_prob))
+    decodeViterbi(workspace, best_path, max_log_prob);
+  double max_prob = exp(max_log_prob);
+
+   //cout << best_path << endl;
+   out_sequence += " ";
+   out_sequence += best_path;
+   if (component_rects != NULL)
+     component_rects->push_back(words_rect[w]);
+   if (component_texts != NULL)
+     component_texts->push_back(best_path);
+   if (component_confidences != NULL)
+     component_confidences->push_back(max_prob);
 
-    vector<int> out_class;
-    vector<double> out_conf;
-    classifier->eval(tmp_src,tmp_mask,out_class,out_conf);
-    if (!out_class.empty())
-      obs.push_back(out_class[0]);
-    observations.push_back(out_class);
-    confidences.push_back(out_conf);
   }
+   
+  return 0;
 
 
-  //This must be extracted from dictionary, or just assumed to be equal for all characters
-  vector<double> start_p(vocabulary.size());
-  for (int i=0; i<vocabulary.size(); i++)
-    start_p[i] = 1.0/vocabulary.size();
+}
 
+// Decodes the word in workspace (obs, observations, confidences) with Viterbi over all
+// the character sequences (pruned if so set, see setPruning)
+void OCRHMMDecoder::decodeViterbi(Workspace& workspace, string& best_path, double& max_log_prob) const
+{
+  vector<int> &obs = workspace.obs;
+
+  //This must be extracted from dictionary, or just assumed to be equal for all characters
+  double log_start_p = safeLog(1.0/vocabulary.size());
+
+  // The Viterbi lattice V (log probabilities) and its backpointers (the best previous
+  // state of each state at each t) are T x vocabulary.size() row-major arrays in the
+  // workspace, they are reused by every word and only grow. The best path is traced back
+  // once at the end.
+  int num_states = (int)vocabulary.size();
+  if (workspace.lattice.size() < obs.size()*num_states)
+  {
+    workspace.lattice.resize(obs.size()*num_states);
+    workspace.backpointers.resize(obs.size()*num_states);
+  }
+  workspace.emission.resize(num_states);
+  double *V = &workspace.lattice[0];
+  int *backpointers = &workspace.backpointers[0];
+  double *log_emission = &workspace.emission[0];
+
+  // In the pruned mode only the top_k states (by emission) of each t are active, and of
+  // them only the ones within the beam of the best score at t. The active states of t
+  // are the row t of active (at most top_k), the rest of the lattice row is -inf.
+  bool pruned = (top_k > 0) && (top_k < num_states);
+  int *active = NULL;
+  if (pruned)
+  {
+    if (workspace.active.size() < obs.size()*top_k)
+      workspace.active.resize(obs.size()*top_k);
+    workspace.num_active.resize(obs.size());
+    active = &workspace.active[0];
+  }
 
-  Mat V = Mat::zeros(observations.size(),vocabulary.size(),CV_64FC1);
-  vector<string> path(vocabulary.size());
-    
   // Initialize base cases (t == 0)
+  wordLogEmissions(workspace, 0, log_emission);
   for (int i=0; i<vocabulary.size(); i++)
   {
-    for (int j=0; j<observations[0].size(); j++)
+    V[i] = log_start_p + log_emission[i];
+    backpointers[i] = i;
+  }
+  if (pruned)
+  {
+    int num_active = topEmissionStates(log_emission, num_states, top_k, workspace.order, active);
+    for (int i=0, n=0; i<num_states; i++)
     {
-      emission_p.at<double>(observations[0][j],obs[0]) = confidences[0][j];
+      if ((n < num_active) && (active[n] == i))
+        n++;
+      else
+        V[i] = -numeric_limits<double>::infinity();
     }
-    V.at<double>(0,i) = start_p[i] * emission_p.at<double>(i,obs[0]);
-    path[i] = vocabulary.at(i);
+    if (beam > 0)
+      num_active = beamPruneStates(V, beam, active, num_active);
+    workspace.num_active[0] = num_active;
   }
 
-    
   // Run Viterbi for t > 0
   for (int t=1; t<obs.size(); t++)
   {
-
     //Dude this has to be done each time!!
-    Mat emission_p = Mat::eye(62,62,CV_64FC1);
-    for (int e=0; e<observations[t].size(); e++)
+    wordLogEmissions(workspace, t, log_emission);
+
+    if (pruned)
     {
-      emission_p.at<double>(observations[t][e],obs[t]) = confidences[t][e];
+      int *states = active+t*top_k;
+      int num_active = topEmissionStates(log_emission, num_states, top_k, workspace.order, states);
+      viterbiStepPruned(V+(t-1)*num_states, active+(t-1)*top_k, workspace.num_active[t-1],
+                        log_transition_t.ptr<double>(), log_emission, num_states, states, num_active,
+                        V+t*num_states, backpointers+t*num_states);
+      if (beam > 0)
+        num_active = beamPruneStates(V+t*num_states, beam, states, num_active);
+      workspace.num_active[t] = num_active;
     }
+    else if (num_states == 62)
+      viterbiStep<62>(V+(t-1)*num_states, log_transition_t.ptr<double>(), log_emission, num_states,
+                      V+t*num_states, backpointers+t*num_states);
+    else
+      viterbiStep<0>(V+(t-1)*num_states, log_transition_t.ptr<double>(), log_emission, num_states,
+                     V+t*num_states, backpointers+t*num_states);
+  }
 
-    vector<string> newpath(vocabulary.size());
+  max_log_prob = -numeric_limits<double>::infinity();
+  int best_idx = 0;
+  for (int i=0; i<vocabulary.size(); i++)
+  {
+    double prob = V[(obs.size()-1)*num_states+i];
+    if ( prob > max_log_prob)
+    {
+      max_log_prob = prob;
+      best_idx = i;
+    }
+  }
+
+  // Trace back the best path
+  best_path.assign(obs.size(), ' ');
+  for (int t=(int)obs.size()-1, state=best_idx; t>=0; t--)
+  {
+    best_path[t] = vocabulary.at(state);
+    state = backpointers[t*num_states+state];
+  }
+}
+
+// Decodes the word in workspace (obs, observations, confidences) as the most likely lexicon
+// word of its length. Hypotheses are the word prefixes, one per (lexicon node, last character)
+// as only these determine how a prefix can be extended, and prefixes that leave the lexicon
+// are never created. Returns false if no lexicon word fits the observations
+bool OCRHMMDecoder::decodeLexicon(Workspace& workspace, string& best_path, double& max_log_prob) const
+{
+  vector<int> &obs = workspace.obs;
+  vector<lexicon_hypothesis> &hypotheses = workspace.hypotheses;
+  vector<int> &start = workspace.hypotheses_start;
+  int num_states = (int)vocabulary.size();
+  const double *log_transition = log_transition_t.ptr<double>();
+  const double minus_inf = -numeric_limits<double>::infinity();
+
+  workspace.emission.resize(num_states);
+  workspace.allowed.resize(num_states);
+  double *log_emission = &workspace.emission[0];
+  bool pruned = (top_k > 0) && (top_k < num_states);
+  if (pruned && (workspace.active.size() < (size_t)top_k))
+    workspace.active.resize(top_k);
+
+  //This must be extracted from dictionary, or just assumed to be equal for all characters
+  double log_start_p = safeLog(1.0/vocabulary.size());
 
-    for (int i=0; i<vocabulary.size(); i++)
+  hypotheses.clear();
+  start.assign(1, 0);
+  for (int t=0; t<obs.size(); t++)
+  {
+    wordLogEmissions(workspace, t, log_emission);
+    if (pruned)
+    {
+      // only the top_k states (by emission) are allowed
+      std::fill(workspace.allowed.begin(), workspace.allowed.end(), 0);
+      int num_active = topEmissionStates(log_emission, num_states, top_k, workspace.order, &workspace.active[0]);
+      for (int n=0; n<num_active; n++)
+        workspace.allowed[workspace.active[n]] = 1;
+    }
+    else
     {
-      double max_prob = 0;
-      int best_idx = 0; 
-      for (int j=0; j<vocabulary.size(); j++)
+      for (int i=0; i<num_states; i++)
+        workspace.allowed[i] = (log_emission[i] > minus_inf);
+    }
+
+    // extend the prefixes of t-1 (the root at t == 0) with the lexicon edges
+    int from = (t == 0) ? -1 : start[t-1];
+    int to   = (t == 0) ?  0 : start[t];
+    for (int h=from; h<to; h++)
+    {
+      int node = (h < 0) ? lexicon->root() : hypotheses[h].node;
+      int label = (h < 0) ? -1 : hypotheses[h].label;
+      double score = (h < 0) ? log_start_p : hypotheses[h].score;
+
+      int num_edges;
+      const OCRLexicon::edge *edges = lexicon->edges(node, num_edges);
+      for (int e=0; e<num_edges; e++)
       {
-        double prob = V.at<double>(t-1,j) * transition_p.at<double>(j,i) * emission_p.at<double>(i,obs[t]);
-        if ( prob > max_prob)
-        {
-          max_prob = prob;
-          best_idx = j;
-        }
+        int i = (int)edges[e].label;
+        if (!workspace.allowed[i])
+          continue;
+        double prob = score + log_emission[i];
+        if (label >= 0)
+          prob += log_transition[i*num_states+label];
+        if (prob == minus_inf)
+          continue;
+
+        lexicon_hypothesis next;
+        next.node  = (int)edges[e].target;
+        next.label = i;
+        next.score = prob;
+        next.prev  = h;
+        hypotheses.push_back(next);
       }
+    }
 
-      V.at<double>(t,i) = max_prob;
-      newpath[i] = path[best_idx] + vocabulary.at(i);
+    // prefixes that reach the same node with the same last character are extended in the
+    // same way, keep the best one
+    vector<lexicon_hypothesis>::iterator first = hypotheses.begin()+start[t];
+    sort(first, hypotheses.end(), hypothesis_order());
+    vector<lexicon_hypothesis>::iterator last = first;
+    for (vector<lexicon_hypothesis>::iterator it=first; it!=hypotheses.end(); it++)
+      if ((it == first) || (it->node != (last-1)->node) || (it->label != (last-1)->label))
+        *last++ = *it;
+    hypotheses.erase(last, hypotheses.end());
+
+    if (beam > 0)
+    {
+      double best_score = minus_inf;
+      for (size_t h=start[t]; h<hypotheses.size(); h++)
+        best_score = max(best_score, hypotheses[h].score);
+      size_t kept = start[t];
+      for (size_t h=start[t]; h<hypotheses.size(); h++)
+        if (hypotheses[h].score >= best_score - beam)
+          hypotheses[kept++] = hypotheses[h];
+      hypotheses.resize(kept);
     }
- 
-    // Don't need to remember the old paths
-    path.swap(newpath);
-  }
- 
-   double max_prob = 0;
-   int best_idx = 0; 
-   for (int i=0; i<vocabulary.size(); i++)
-   {
-        double prob = V.at<double>(obs.size()-1,i);
-        if ( prob > max_prob)
-        {
-          max_prob = prob;
-          best_idx = i;
-        }
-   }
 
-   //cout << path[best_idx] << endl;
-   out_sequence = out_sequence+" "+path[best_idx];
-	 component_rects->push_back(words_rect[w]);
-   component_texts->push_back(path[best_idx]);
-   component_confidences->push_back(max_prob);
+    // all the prefixes left the lexicon
+    if ((int)hypotheses.size() == start[t])
+      return false;
+    start.push_back((int)hypotheses.size());
+  }
 
+  // the best complete word
+  int best_idx = -1;
+  for (int h=start[obs.size()-1]; h<start[obs.size()]; h++)
+    if (lexicon->isFinal(hypotheses[h].node) &&
+        ((best_idx < 0) || (hypotheses[h].score > hypotheses[best_idx].score)))
+      best_idx = h;
+  if (best_idx < 0)
+    return false;
+
+  max_log_prob = hypotheses[best_idx].score;
+  best_path.assign(obs.size(), ' ');
+  for (int t=(int)obs.size()-1, h=best_idx; t>=0; t--)
+  {
+    best_path[t] = vocabulary.at(hypotheses[h].label);
+    h = hypotheses[h].prev;
   }
-   
-  return 0;
+  return true;
+}
 
+// Log emission probabilities of every state for the character t of the word in workspace:
+// the emission table at t == 0 and the identity at t > 0, but for the observed classes
+// (in the column of obs[t])
+void OCRHMMDecoder::wordLogEmissions(Workspace& workspace, int t, double *log_emission) const
+{
+  vector<int> &obs = workspace.obs;
+  vector<int> &observations = workspace.observations[t];
+  vector<double> &confidences = workspace.confidences[t];
+  int num_states = (int)vocabulary.size();
 
+  if (t == 0)
+  {
+    for (int i=0; i<num_states; i++)
+      log_emission[i] = safeLog(emission_p.at<double>(i,obs[0]));
+  }
+  else
+  {
+    for (int i=0; i<num_states; i++)
+      log_emission[i] = -numeric_limits<double>::infinity();
+    log_emission[obs[t]] = 0;
+  }
+  for (int e=0; e<observations.size(); e++)
+  {
+    log_emission[observations[e]] = safeLog(confidences[e]);
+  }
 }
 
 class CV_EXPORTS OCRHMMClassifierMLP : public OCRHMMDecoder::ClassifierCallback
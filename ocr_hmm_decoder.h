@@ -1,3 +1,6 @@
+#ifndef OCR_HMM_DECODER_H
+#define OCR_HMM_DECODER_H
+
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/objdetect.hpp>
@@ -6,6 +9,8 @@
 #include <iostream>
 #include <fstream>
 
+#include "ocr_lexicon.h"
+
 using namespace cv;
 using namespace std;
 
@@ -15,6 +20,17 @@ enum decoder_mode
     DECODER_VITERBI = 0 // Other algorithms may be added
 };
 
+// struct lexicon_hypothesis
+// A word prefix in the lexicon-constrained decoding: the lexicon node it reaches, its last
+// character, its log probability and the prefix it extends (-1 at the first character)
+struct lexicon_hypothesis
+{
+    int node;
+    int label;
+    double score;
+    int prev;
+};
+
 class CV_EXPORTS OCRHMMDecoder : public Algorithm
 {
 public:
@@ -40,6 +56,51 @@ public:
 
     ~OCRHMMDecoder();
 
+    //! Pruned decoding: at each character only the top_k states with the highest emission
+    //  probability are kept (0 keeps all), and of them only the ones whose accumulated log
+    //  probability is within beam of the best one (beam <= 0 disables the beam).
+    //  Each step costs top_k^2 instead of vocabulary.size()^2. Not to be called while run()
+    //  is in progress.
+    void setPruning(int top_k, double beam=0);
+
+    //! Lexicon-constrained decoding: words are decoded as the most likely lexicon word of
+    //  their length (or unconstrained if none fits), an empty pointer disables it.
+    //  The lexicon vocabulary must be the decoder's one. Not to be called while run() is
+    //  in progress.
+    void setLexicon(const Ptr<OCRLexicon>& lexicon);
+
+    //! Scratch memory of run() (word split, Viterbi lattice, emissions, contours), owned by
+    //  the caller. run() only reads the decoder, so any number of threads can share one decoder
+    //  as long as each one uses its own workspace (and the classifier's eval is thread-safe).
+    //  The buffers only grow, so with a workspace reused for every call the decoder's own
+    //  buffers stop being reallocated once it has seen the largest line (findContours and
+    //  the classifier still allocate internally).
+    struct Workspace
+    {
+        vector<Rect> words_rect;                // words of the line (the word images are views)
+        vector<float> column_sums;              // mask column sums, to find the spaces
+        vector<int> spaces;                     // length, start and end of each space
+        vector<int> spaces_start;
+        vector<int> spaces_end;
+        string best_path;                       // decoded word
+        vector<double> lattice;                 // log probabilities, T x vocabulary.size()
+        vector<int> backpointers;               // best previous state, T x vocabulary.size()
+        vector<double> emission;                // log emission probabilities at t
+        vector<int> active;                     // pruned mode: active states, T x top_k
+        vector<int> num_active;                 // pruned mode: number of active states at t
+        vector<int> order;                      // pruned mode: states ranked by emission
+        vector<lexicon_hypothesis> hypotheses;  // lexicon mode: prefixes of every t
+        vector<int> hypotheses_start;           // lexicon mode: first prefix of each t
+        vector<unsigned char> allowed;          // lexicon mode: states allowed at t
+        vector< vector<int> > observations;     // classifier output of each character
+        vector< vector<double> > confidences;
+        vector<int> obs;                        // best class of each character
+        vector< vector<Point> > contours;
+        vector<Vec4i> hierarchy;
+        vector<Rect> contours_rect;
+        Mat contours_img;                       // findContours input (it is modified), grown to the line
+    };
+
     //! Decode a group of regions and output the most likely sequence of characters
     // output probability of the output sequence
     double run( InputArray src,              // RGB or greyscale original image (in case the feature extractor needs it)
@@ -48,7 +109,17 @@ public:
 	            vector<Rect>* component_rects=NULL, 
               vector<string>* component_texts=NULL, 
               vector<float>* component_confidences=NULL,
-              int component_level=0);  // specify words, lines, etc...
+              int component_level=0) const;  // specify words, lines, etc...
+
+    //! Same as above with a caller-owned workspace (e.g. one per thread)
+    double run( InputArray src,
+              InputArray mask,
+              string& out_sequence,
+              Workspace& workspace,
+              vector<Rect>* component_rects=NULL,
+              vector<string>* component_texts=NULL,
+              vector<float>* component_confidences=NULL,
+              int component_level=0) const;
 
 protected:
 
@@ -57,8 +128,20 @@ protected:
     Mat transition_p;
     Mat emission_p;
     decoder_mode mode;
+    int top_k;
+    double beam;
+    Ptr<OCRLexicon> lexicon;
+
+    void decodeViterbi(Workspace& workspace, string& best_path, double& max_log_prob) const;
+    bool decodeLexicon(Workspace& workspace, string& best_path, double& max_log_prob) const;
+    void wordLogEmissions(Workspace& workspace, int t, double *log_emission) const;
+
+    //! log(transition_p) transposed, row i holds the transitions into state i
+    Mat log_transition_t;
+
 };
 
 Ptr<OCRHMMDecoder::ClassifierCallback> loadOCRHMMClassifierMLP(const std::string& filename);
 Ptr<OCRHMMDecoder::ClassifierCallback> loadOCRHMMClassifierKNN(const std::string& filename);
 
+#endif
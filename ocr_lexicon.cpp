@@ -0,0 +1,203 @@
+#include "ocr_lexicon.h"
+
+#include <fstream>
+#include <map>
+#include <queue>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char LEXICON_MAGIC[8] = {'O','C','R','L','E','X','1','\0'};
+
+const uint32_t OCRLexicon::FINAL_BIT;
+
+OCRLexicon::OCRLexicon(const string& filename) : data(NULL), data_size(0), hdr(NULL), nodes(NULL), edge_table(NULL)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    CV_Error(CV_StsBadArg, "Lexicon file not found!");
+
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(header)))
+  {
+    close(fd);
+    CV_Error(CV_StsBadArg, "Not a lexicon file!");
+  }
+  data_size = (size_t)st.st_size;
+  data = mmap(NULL, data_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    data = NULL;
+    CV_Error(CV_StsError, "Could not map the lexicon file!");
+  }
+
+  hdr = (const header*)data;
+  nodes = (const node*)((const char*)data + sizeof(header));
+  edge_table = (const edge*)(nodes + hdr->num_nodes);
+
+  // the whole file is checked once, so that walking it never goes out of bounds
+  bool valid = (memcmp(hdr->magic, LEXICON_MAGIC, sizeof(LEXICON_MAGIC)) == 0) &&
+               (hdr->num_nodes > 0) && (hdr->vocabulary_size <= sizeof(hdr->vocabulary)) &&
+               ((uint64_t)data_size == (uint64_t)sizeof(header) + (uint64_t)hdr->num_nodes*sizeof(node) +
+                                       (uint64_t)hdr->num_edges*sizeof(edge));
+  for (uint32_t n=0; valid && (n<hdr->num_nodes); n++)
+    valid = ((uint64_t)nodes[n].first_edge + (nodes[n].num_edges & ~FINAL_BIT) <= hdr->num_edges);
+  for (uint32_t e=0; valid && (e<hdr->num_edges); e++)
+    valid = (edge_table[e].label < hdr->vocabulary_size) && (edge_table[e].target < hdr->num_nodes);
+  if (!valid)
+  {
+    munmap(data, data_size);
+    data = NULL;
+    CV_Error(CV_StsBadArg, "Not a lexicon file!");
+  }
+}
+
+OCRLexicon::~OCRLexicon()
+{
+  if (data != NULL)
+    munmap(data, data_size);
+}
+
+// struct dawg_node
+// A node of the automaton while it is built, edges in increasing label order
+struct dawg_node
+{
+  bool final;
+  vector< pair<int,int> > edges; // (label, child)
+  dawg_node() : final(false) {}
+};
+
+// Minimizes the nodes of the last word added below depth (deepest first): a node equivalent
+// to an already registered one is replaced by it, otherwise it is registered
+// in/out path the nodes of the last word added, truncated to depth
+static void registerSuffix(vector<dawg_node>& dawg, map<vector<int>,int>& registry, vector<int>& path, size_t depth)
+{
+  for (size_t k=path.size()-1; k>depth; k--)
+  {
+    int child = path[k];
+    vector<int> signature(1, (int)dawg[child].final);
+    for (size_t e=0; e<dawg[child].edges.size(); e++)
+    {
+      signature.push_back(dawg[child].edges[e].first);
+      signature.push_back(dawg[child].edges[e].second);
+    }
+
+    map<vector<int>,int>::iterator it = registry.find(signature);
+    if (it != registry.end())
+      dawg[path[k-1]].edges.back().second = it->second;
+    else
+      registry[signature] = child;
+  }
+  path.resize(depth+1);
+}
+
+int OCRLexicon::compile(const vector<string>& words, const string& vocabulary, const string& filename)
+{
+  CV_Assert( !vocabulary.empty() && (vocabulary.size() <= sizeof(((header*)0)->vocabulary)) );
+
+  // words as strings of labels, sorted as the automaton is built in label order
+  vector<string> labelled;
+  for (size_t w=0; w<words.size(); w++)
+  {
+    string labels;
+    size_t i = 0;
+    for (; i<words[w].size(); i++)
+    {
+      size_t label = vocabulary.find(words[w][i]);
+      if (label == string::npos)
+        break;
+      labels.push_back((char)label);
+    }
+    if ((i == words[w].size()) && !labels.empty())
+      labelled.push_back(labels);
+  }
+  sort(labelled.begin(), labelled.end());
+  labelled.erase(unique(labelled.begin(), labelled.end()), labelled.end());
+
+  // incremental construction of the minimal automaton from sorted words (Daciuk et al.)
+  vector<dawg_node> dawg(1);
+  map<vector<int>,int> registry;
+  vector<int> path(1, 0);
+  string previous;
+  for (size_t w=0; w<labelled.size(); w++)
+  {
+    const string& word = labelled[w];
+    size_t common = 0;
+    while ((common < word.size()) && (common < previous.size()) && (word[common] == previous[common]))
+      common++;
+
+    registerSuffix(dawg, registry, path, common);
+    for (size_t i=common; i<word.size(); i++)
+    {
+      int child = (int)dawg.size();
+      dawg.push_back(dawg_node());
+      dawg[path.back()].edges.push_back(pair<int,int>((unsigned char)word[i], child));
+      path.push_back(child);
+    }
+    dawg[path.back()].final = true;
+    previous = word;
+  }
+  registerSuffix(dawg, registry, path, 0);
+
+  // number the reachable nodes breadth-first (the replaced ones are dropped), root first
+  vector<int> id(dawg.size(), -1);
+  vector<int> order;
+  queue<int> pending;
+  id[0] = 0;
+  pending.push(0);
+  while (!pending.empty())
+  {
+    int n = pending.front();
+    pending.pop();
+    order.push_back(n);
+    for (size_t e=0; e<dawg[n].edges.size(); e++)
+    {
+      int child = dawg[n].edges[e].second;
+      if (id[child] < 0)
+      {
+        id[child] = (int)(order.size() + pending.size());
+        pending.push(child);
+      }
+    }
+  }
+
+  header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, LEXICON_MAGIC, sizeof(LEXICON_MAGIC));
+  hdr.num_nodes = (uint32_t)order.size();
+  hdr.vocabulary_size = (uint32_t)vocabulary.size();
+  memcpy(hdr.vocabulary, vocabulary.data(), vocabulary.size());
+
+  vector<node> node_table(order.size());
+  vector<edge> edge_table;
+  for (size_t n=0; n<order.size(); n++)
+  {
+    dawg_node &d = dawg[order[n]];
+    node_table[n].first_edge = (uint32_t)edge_table.size();
+    node_table[n].num_edges = (uint32_t)d.edges.size() | (d.final ? FINAL_BIT : 0);
+    for (size_t e=0; e<d.edges.size(); e++)
+    {
+      edge ed;
+      ed.label = (uint32_t)d.edges[e].first;
+      ed.target = (uint32_t)id[d.edges[e].second];
+      edge_table.push_back(ed);
+    }
+  }
+  hdr.num_edges = (uint32_t)edge_table.size();
+
+  ofstream out(filename.c_str(), ios::out | ios::binary);
+  if (!out)
+    CV_Error(CV_StsError, "Could not write the lexicon file!");
+  out.write((const char*)&hdr, sizeof(hdr));
+  out.write((const char*)&node_table[0], node_table.size()*sizeof(node));
+  if (!edge_table.empty())
+    out.write((const char*)&edge_table[0], edge_table.size()*sizeof(edge));
+  if (!out)
+    CV_Error(CV_StsError, "Could not write the lexicon file!");
+
+  return (int)labelled.size();
+}
@@ -0,0 +1,80 @@
+#ifndef OCR_LEXICON_H
+#define OCR_LEXICON_H
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// class OCRLexicon
+// A word list compiled into a minimal acyclic automaton (DAWG), memory-mapped read-only
+// from its file. Labels are indices in the decoder vocabulary, so the OCRHMMDecoder can walk
+// the automaton jointly with the observation sequence (see OCRHMMDecoder::setLexicon).
+// The mapped pages are shared by every thread and process that loads the same file.
+//
+// File layout (host byte order), all arrays follow the header:
+//   header   magic, number of nodes and edges, vocabulary
+//   node[]   first edge and number of edges of each node (node 0 is the root), the high
+//            bit of num_edges marks the nodes that end a word
+//   edge[]   label and target node, the edges of a node are sorted by label
+class OCRLexicon
+{
+  public:
+    struct header
+    {
+        char     magic[8];
+        uint32_t num_nodes;
+        uint32_t num_edges;
+        uint32_t vocabulary_size;
+        char     vocabulary[256];
+    };
+    struct node
+    {
+        uint32_t first_edge;
+        uint32_t num_edges;
+    };
+    struct edge
+    {
+        uint32_t label;
+        uint32_t target;
+    };
+
+    //! maps a lexicon file written by compile()
+    explicit OCRLexicon(const string& filename);
+    ~OCRLexicon();
+
+    //! the vocabulary the labels index into
+    string vocabulary() const { return string(hdr->vocabulary, hdr->vocabulary_size); }
+
+    int root() const { return 0; }
+    int numNodes() const { return (int)hdr->num_nodes; }
+    bool isFinal(int n) const { return (nodes[n].num_edges & FINAL_BIT) != 0; }
+    //! the edges leaving node n (sorted by label), num is set to their number
+    const edge* edges(int n, int &num) const
+    {
+      num = (int)(nodes[n].num_edges & ~FINAL_BIT);
+      return edge_table + nodes[n].first_edge;
+    }
+
+    //! compiles words into a lexicon file, words with characters out of the vocabulary are
+    //  skipped. Returns the number of (distinct) words stored
+    static int compile(const vector<string>& words, const string& vocabulary, const string& filename);
+
+  private:
+    OCRLexicon(const OCRLexicon&);
+    OCRLexicon& operator=(const OCRLexicon&);
+
+    static const uint32_t FINAL_BIT = 0x80000000u;
+
+    void *data;
+    size_t data_size;
+    const header *hdr;
+    const node *nodes;
+    const edge *edge_table;
+};
+
+#endif
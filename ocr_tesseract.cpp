@@ -1,5 +1,8 @@
 #include "ocr_tesseract.h"
 
+#include <sys/time.h>
+#include <errno.h>
+
 //Default constructor
 OCRTesseract::OCRTesseract(const char* datapath, const char* language, const char* char_whitelist, tesseract::OcrEngineMode oemode, tesseract::PageSegMode psmode)
 {
@@ -40,34 +43,7 @@ void OCRTesseract::run(Mat& image, string& output, vector<Rect>* component_rects
   tess.Recognize(0); 
   output = string(tess.GetUTF8Text());
 
-  if ( (component_rects != NULL) || (component_texts != NULL) || (component_confidences != NULL) )
-  {
-    tesseract::ResultIterator* ri = tess.GetIterator();
-    tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
-    if (component_level == OCR_LEVEL_TEXTLINE)
-      level = tesseract::RIL_TEXTLINE;
-
-    if (ri != 0) {
-      do {
-        const char* word = ri->GetUTF8Text(level);
-        if (word == NULL)
-          continue;
-        float conf = ri->Confidence(level);
-        int x1, y1, x2, y2;
-        ri->BoundingBox(level, &x1, &y1, &x2, &y2);
-
-        if (component_texts != 0)
-          component_texts->push_back(string(word));
-        if (component_rects != 0)
-          component_rects->push_back(Rect(x1,y1,x2-x1,y2-y1));
-        if (component_confidences != 0)
-          component_confidences->push_back(conf);
-
-        delete[] word;
-      } while (ri->Next(level));
-    }
-    delete ri;
-  }
+  getComponents(Point(0,0), component_rects, component_texts, component_confidences, component_level);
 
   /*tesseract::ResultIterator* ri = tess.GetIterator();
   tesseract::ChoiceIterator* ci; 
@@ -104,3 +80,249 @@ void OCRTesseract::run(Mat& image, string& output, vector<Rect>* component_rects
 
   tess.Clear();
 }
+
+void OCRTesseract::run(Mat& image, vector<Rect>& rois, vector<string>& output_texts, vector< vector<Rect> >* component_rects, 
+                       vector< vector<string> >* component_texts, vector< vector<float> >* component_confidences, int component_level)
+{
+  output_texts.assign(rois.size(), string());
+  if (component_rects != NULL)
+    component_rects->assign(rois.size(), vector<Rect>());
+  if (component_texts != NULL)
+    component_texts->assign(rois.size(), vector<string>());
+  if (component_confidences != NULL)
+    component_confidences->assign(rois.size(), vector<float>());
+
+  // only the bounding box of all the rois is handed to tesseract (which makes its own copy of it)
+  Rect image_rect(0, 0, image.cols, image.rows);
+  Rect bounds;
+  for (size_t i=0; i<rois.size(); i++)
+  {
+    Rect roi = rois[i] & image_rect;
+    if (roi.area() == 0)
+      continue;
+    bounds = (bounds.area() == 0) ? roi : (bounds | roi);
+  }
+  if (bounds.area() == 0)
+    return;
+
+  Mat view = image(bounds);
+  tess.SetImage((uchar*)view.data, view.size().width, view.size().height, view.channels(), view.step1());
+
+  for (size_t i=0; i<rois.size(); i++)
+  {
+    Rect roi = rois[i] & image_rect;
+    if (roi.area() == 0)
+      continue;
+
+    tess.SetRectangle(roi.x-bounds.x, roi.y-bounds.y, roi.width, roi.height);
+    tess.Recognize(0);
+    char* text = tess.GetUTF8Text();
+    if (text != NULL)
+    {
+      output_texts[i] = string(text);
+      delete[] text;
+    }
+
+    getComponents(bounds.tl(),
+                  (component_rects != NULL) ? &(*component_rects)[i] : NULL,
+                  (component_texts != NULL) ? &(*component_texts)[i] : NULL,
+                  (component_confidences != NULL) ? &(*component_confidences)[i] : NULL,
+                  component_level);
+  }
+
+  tess.Clear();
+}
+
+void OCRTesseract::run(Mat& image, Rect roi, string& output, vector<Rect>* component_rects, 
+                       vector<string>* component_texts, vector<float>* component_confidences, int component_level)
+{
+  vector<Rect> rois(1, roi);
+  vector<string> outputs;
+  vector< vector<Rect> > rects;
+  vector< vector<string> > texts;
+  vector< vector<float> > confidences;
+
+  run(image, rois, outputs, (component_rects != NULL) ? &rects : NULL,
+      (component_texts != NULL) ? &texts : NULL,
+      (component_confidences != NULL) ? &confidences : NULL, component_level);
+
+  output = outputs[0];
+  if (component_rects != NULL)
+    component_rects->insert(component_rects->end(), rects[0].begin(), rects[0].end());
+  if (component_texts != NULL)
+    component_texts->insert(component_texts->end(), texts[0].begin(), texts[0].end());
+  if (component_confidences != NULL)
+    component_confidences->insert(component_confidences->end(), confidences[0].begin(), confidences[0].end());
+}
+
+void OCRTesseract::getComponents(Point offset, vector<Rect>* component_rects, vector<string>* component_texts,
+                                 vector<float>* component_confidences, int component_level)
+{
+  if ( (component_rects == NULL) && (component_texts == NULL) && (component_confidences == NULL) )
+    return;
+
+  tesseract::ResultIterator* ri = tess.GetIterator();
+  tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
+  if (component_level == OCR_LEVEL_TEXTLINE)
+    level = tesseract::RIL_TEXTLINE;
+
+  if (ri != 0) {
+    do {
+      const char* word = ri->GetUTF8Text(level);
+      if (word == NULL)
+        continue;
+      float conf = ri->Confidence(level);
+      int x1, y1, x2, y2;
+      // tesseract gives the boxes in coordinates of the image it was set, not of the rectangle
+      ri->BoundingBox(level, &x1, &y1, &x2, &y2);
+
+      if (component_texts != 0)
+        component_texts->push_back(string(word));
+      if (component_rects != 0)
+        component_rects->push_back(Rect(x1+offset.x,y1+offset.y,x2-x1,y2-y1));
+      if (component_confidences != 0)
+        component_confidences->push_back(conf);
+
+      delete[] word;
+    } while (ri->Next(level));
+  }
+  delete ri;
+}
+
+OCRTesseractPool::OCRTesseractPool(int _max_engines, const char* _datapath, const char* _language, const char* _char_whitelist, tesseract::OcrEngineMode _oemode, tesseract::PageSegMode _psmode)
+  : max_engines(_max_engines), num_creating(0),
+    has_datapath(_datapath != NULL), has_language(_language != NULL), has_char_whitelist(_char_whitelist != NULL),
+    oemode(_oemode), psmode(_psmode)
+{
+  CV_Assert( max_engines > 0 );
+
+  if (has_datapath)
+    datapath = _datapath;
+  if (has_language)
+    language = _language;
+  if (has_char_whitelist)
+    char_whitelist = _char_whitelist;
+
+  // the first engine is created right away, so a bad configuration fails here
+  engines.push_back(createEngine());
+  idle = engines;
+
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&available, NULL);
+}
+
+OCRTesseractPool::~OCRTesseractPool()
+{
+  for (size_t i=0; i<engines.size(); i++)
+    delete engines[i];
+
+  pthread_cond_destroy(&available);
+  pthread_mutex_destroy(&mutex);
+}
+
+OCRTesseract* OCRTesseractPool::createEngine()
+{
+  return new OCRTesseract(has_datapath ? datapath.c_str() : NULL, has_language ? language.c_str() : NULL,
+                          has_char_whitelist ? char_whitelist.c_str() : NULL, oemode, psmode);
+}
+
+void OCRTesseractPool::warmUp(int num_engines)
+{
+  num_engines = min(num_engines, max_engines);
+  pthread_mutex_lock(&mutex);
+  while ((int)engines.size() + num_creating < num_engines)
+  {
+    num_creating++;
+    pthread_mutex_unlock(&mutex);
+    OCRTesseract* engine = NULL;
+    try
+    {
+      engine = createEngine();
+    }
+    catch (...)
+    {
+      pthread_mutex_lock(&mutex);
+      num_creating--;
+      pthread_mutex_unlock(&mutex);
+      throw;
+    }
+    pthread_mutex_lock(&mutex);
+    num_creating--;
+    engines.push_back(engine);
+    idle.push_back(engine);
+    pthread_cond_signal(&available);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+int OCRTesseractPool::size()
+{
+  pthread_mutex_lock(&mutex);
+  int num_engines = (int)engines.size();
+  pthread_mutex_unlock(&mutex);
+  return num_engines;
+}
+
+OCRTesseract* OCRTesseractPool::checkout(int timeout_ms)
+{
+  struct timespec deadline;
+  if (timeout_ms >= 0)
+  {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long nsec = (long long)now.tv_usec*1000 + (long long)(timeout_ms%1000)*1000000;
+    deadline.tv_sec  = now.tv_sec + timeout_ms/1000 + (time_t)(nsec/1000000000);
+    deadline.tv_nsec = (long)(nsec%1000000000);
+  }
+
+  OCRTesseract* engine = NULL;
+  pthread_mutex_lock(&mutex);
+  if (idle.empty() && ((int)engines.size() + num_creating < max_engines))
+  {
+    // grow the pool, the (slow) initialization runs without holding the lock
+    num_creating++;
+    pthread_mutex_unlock(&mutex);
+    try
+    {
+      engine = createEngine();
+    }
+    catch (...)
+    {
+      engine = NULL;
+    }
+    pthread_mutex_lock(&mutex);
+    num_creating--;
+    if (engine != NULL)
+    {
+      engines.push_back(engine);
+      pthread_mutex_unlock(&mutex);
+      return engine;
+    }
+    // could not create it, wait for an existing one
+  }
+  while (idle.empty())
+  {
+    if (timeout_ms < 0)
+      pthread_cond_wait(&available, &mutex);
+    else if (pthread_cond_timedwait(&available, &mutex, &deadline) == ETIMEDOUT)
+      break;
+  }
+  if (!idle.empty())
+  {
+    engine = idle.back();
+    idle.pop_back();
+  }
+  pthread_mutex_unlock(&mutex);
+
+  return engine;
+}
+
+void OCRTesseractPool::checkin(OCRTesseract* engine)
+{
+  CV_Assert( engine != NULL );
+
+  pthread_mutex_lock(&mutex);
+  idle.push_back(engine);
+  pthread_cond_signal(&available);
+  pthread_mutex_unlock(&mutex);
+}
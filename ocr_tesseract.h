@@ -7,6 +7,7 @@
 #include <opencv2/imgproc.hpp>
 
 #include <iostream>
+#include <pthread.h>
 //#include <locale.h>
 
 using namespace cv;
@@ -32,10 +33,68 @@ class OCRTesseract
 	  void run(Mat& image, string& output_text, vector<Rect>* component_rects=NULL, 
              vector<string>* component_texts=NULL, vector<float>* component_confidences=NULL,
              int component_level=0);
-	  //void run(Mat& image, vector<Rect> rois, string& output_text, vector<Rect>& component_rects=NULL, 
-    //         vector<string>& component_texts=NULL, vector<float>& component_confidences=NULL);
-	  //void run(Mat& img, vector<Rect>& rois, string& output);
+	  //Recognizes each of the rois of a shared image (rois are clipped to the image),
+	  //the image is handed to tesseract once and each roi is set as its recognition rectangle.
+	  //Results are given per roi, with the component boxes in image coordinates.
+	  void run(Mat& image, vector<Rect>& rois, vector<string>& output_texts, vector< vector<Rect> >* component_rects=NULL, 
+             vector< vector<string> >* component_texts=NULL, vector< vector<float> >* component_confidences=NULL,
+             int component_level=0);
+	  //Same as above for a single roi
+	  void run(Mat& image, Rect roi, string& output_text, vector<Rect>* component_rects=NULL, 
+             vector<string>* component_texts=NULL, vector<float>* component_confidences=NULL,
+             int component_level=0);
 	  //void run(Mat& img, vector<vector<Point> >& regions, string& output);
 	  //void run(InputArrayOfArrays& channels, vector<vector<ERStat> >& regions, string& output);
+
+	private:
+		//Collects the recognized components of the current rectangle, offset by the given point
+		void getComponents(Point offset, vector<Rect>* component_rects, vector<string>* component_texts,
+		                   vector<float>* component_confidences, int component_level);
 };
 
+// class OCRTesseractPool
+// A set of up to max_engines OCRTesseract engines. TessBaseAPI is not reentrant,
+// so a thread must checkout() an engine, use it exclusively and checkin() it back.
+// The first engine is created with the pool, the others by warmUp() or when a checkout()
+// finds no idle engine and the pool is not full.
+class OCRTesseractPool
+{
+	private:
+		vector<OCRTesseract*> engines;
+		vector<OCRTesseract*> idle;
+		int max_engines;
+		int num_creating; // engines being created outside the lock
+		//Engine parameters, kept for the engines created on demand
+		string datapath, language, char_whitelist;
+		bool has_datapath, has_language, has_char_whitelist;
+		tesseract::OcrEngineMode oemode;
+		tesseract::PageSegMode psmode;
+		pthread_mutex_t mutex;
+		pthread_cond_t  available;
+
+		OCRTesseractPool(const OCRTesseractPool&);
+		OCRTesseractPool& operator=(const OCRTesseractPool&);
+
+  public:
+		//Creates a pool of at most max_engines engines with the same parameters as OCRTesseract
+		OCRTesseractPool(int max_engines, const char* datapath=NULL, const char* language=NULL, const char* char_whitelist=NULL, tesseract::OcrEngineMode oem=tesseract::OEM_DEFAULT, tesseract::PageSegMode psmode=tesseract::PSM_AUTO);
+
+		~OCRTesseractPool();
+
+		//Takes an idle engine, or creates one if there is none and the pool is not full,
+		//otherwise waits at most timeout_ms milliseconds for one to be checked in
+		//(timeout_ms < 0 waits forever). Returns NULL if the wait timed out.
+		OCRTesseract* checkout(int timeout_ms=-1);
+		//Gives back an engine obtained with checkout()
+		void checkin(OCRTesseract* engine);
+
+		//Creates engines until there are num_engines (at most max_engines), so that the
+		//first parallel checkouts do not pay for their initialization
+		void warmUp(int num_engines);
+
+		//Number of engines created so far
+		int size();
+
+	private:
+		OCRTesseract* createEngine();
+};
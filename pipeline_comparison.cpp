@@ -7,8 +7,12 @@
 
 #include "ocr_tesseract.h"
 #include "ocr_hmm_decoder.h"
+#include "model_registry.h"
+#include "image_context.h"
+#include "erdetection_nm.h"
 #include "ergrouping_nm.h"
 #include "msers_to_erstats.h"
+#include "er_draw.h"
 
 #define REGION_TYPE        0 // 0=ERStats, 1=MSER, 2=canny+contour
 #define GROUPING_ALGORITHM 1 // 0=exhaustive_search, 1=exhaustive_search + feedback loop, 2=multioriented
@@ -16,6 +20,9 @@
                              // 3=croped image + adaptive threshold, 4= cropped image + otsu threshold
                              
 #define RECOGNITION        1 // 0=tesseract, 1=NM_chain_features+KNN, 2=NM_chain_features+MLP
+#define HMM_TOP_K          0 // pruned HMM decoding: states kept per character (0=all)
+#define HMM_BEAM           0 // pruned HMM decoding: log-probability beam (0=no beam)
+#define HMM_LEXICON        "" // lexicon-constrained HMM decoding: compiled lexicon file (""=none)
 
 
 using namespace cv;
@@ -27,7 +34,9 @@ size_t min(size_t x, size_t y, size_t z);
 bool   isRepetitive(const string& s);
 bool   sort_by_lenght(const string &a, const string &b){return (a.size()>b.size());};
 //Draw ER's in an image via floodFill
-void   er_draw(vector<Mat> &channels, vector<vector<ERStat> > &regions, vector<Vec2i> group, Mat& segmentation);
+void   er_draw(vector<Mat> &channels, vector<ERStatArena> &regions, vector<Vec2i> group, Mat& segmentation);
+//Grey level crop of a group box (5 pixels margin, clipped to the image)
+Rect   crop_roi(const Rect& box, const Size& image_size);
 
 //Perform text detection and recognition and evaluate results using edit distance
 int main(int argc, char* argv[]) 
@@ -46,16 +55,15 @@ int main(int argc, char* argv[])
 
   /*Text Detection*/
 
-  Mat grey,orig_grey;
-  cvtColor(image,grey,COLOR_RGB2GRAY);
-  grey.copyTo(orig_grey);
+  // Images derived from the frame are computed once and shared by all the stages
+  ImageContext context(image);
+  Mat grey = context.grey();
   // Extract channels to be processed individually
   vector<Mat> channels;
-  channels.push_back(grey);
-  channels.push_back(255-grey);
+  context.channels(channels);
 
 
-  vector<vector<ERStat> > regions(channels.size());
+  vector<ERStatArena> regions(channels.size());
   double t_d = (double)getTickCount();
 
   switch (REGION_TYPE)
@@ -63,16 +71,12 @@ int main(int argc, char* argv[])
     case 0:
     {
       // ERStat
-      // Create ERFilter objects with the 1st and 2nd stage default classifiers
-      Ptr<ERFilter> er_filter1 = createERFilterNM1(loadClassifierNM1("trained_classifierNM1.xml"),8,0.00015,0.13,0.2,true,0.1);
-      Ptr<ERFilter> er_filter2 = createERFilterNM2(loadClassifierNM2("trained_classifierNM2.xml"),0.5);
+      // Get the 1st and 2nd stage default classifiers (ERFilter objects are created per worker)
+      Ptr<ERFilter::Callback> er_classifier1 = ModelRegistry::instance().classifierNM1();
+      Ptr<ERFilter::Callback> er_classifier2 = ModelRegistry::instance().classifierNM2();
     
-      // Apply the default cascade classifier to each independent channel (could be done in parallel)
-      for (int c=0; c<(int)channels.size(); c++)
-      {
-          er_filter1->run(channels[c], regions[c]);
-          er_filter2->run(channels[c], regions[c]);
-      }
+      // Apply the default cascade classifier to each independent channel in parallel
+      erDetectionNM(channels, regions, er_classifier1, er_classifier2);
       break;
     }
     case 1:
@@ -116,17 +120,21 @@ int main(int argc, char* argv[])
   {
     case 0:
     {
-      erGroupingNM(image, channels, regions, nm_region_groups, nm_boxes, false);
+      erGroupingNM(context, channels, regions, nm_region_groups, nm_boxes, false);
       break;
     }
     case 1:
     {
-      erGroupingNM(image, channels, regions, nm_region_groups, nm_boxes, true);
+      erGroupingNM(context, channels, regions, nm_region_groups, nm_boxes, true);
       break;
     }
     case 2:
     {
-      erGrouping(image, channels, regions, nm_region_groups, nm_boxes, ERGROUPING_ORIENTATION_ANY, "./trained_classifier_erGrouping.xml", 0.5);
+      // erGrouping only takes plain vectors of regions
+      vector< vector<ERStat> > regions_vec(regions.size());
+      for (size_t c=0; c<regions.size(); c++)
+        regions[c].copyTo(regions_vec[c]);
+      erGrouping(image, channels, regions_vec, nm_region_groups, nm_boxes, ERGROUPING_ORIENTATION_ANY, "./trained_classifier_erGrouping.xml", 0.5);
       break;
     }
   }
@@ -150,23 +158,23 @@ int main(int argc, char* argv[])
   }
   else 
   {
-    transition_p = Mat(62,62,CV_64FC1);
-    string filename = "transitions_OCRHMM.xml";
-    FileStorage fs(filename, FileStorage::READ);
-    fs["transition_probabilities"] >> transition_p;
+    transition_p = ModelRegistry::instance().transitionsOCRHMM();
     emission_p = Mat::eye(62,62,CV_64FC1);
     voc = "abcdefghijklmnopqrtsuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
 
     if (RECOGNITION == 1)
     {
-      ocr = (void*) new OCRHMMDecoder(loadOCRHMMClassifierKNN("ocr_hmm_decoder_train/mlp_mask/knn_model_data.xml"), 
+      ocr = (void*) new OCRHMMDecoder(ModelRegistry::instance().classifierKNN(), 
                                       voc, transition_p, emission_p);
     }
     if (RECOGNITION == 2)
     {
-      ocr = (void*) new OCRHMMDecoder(loadOCRHMMClassifierMLP("ocr_hmm_decoder_train/mlp_mask/trained_mlp.xml"), 
+      ocr = (void*) new OCRHMMDecoder(ModelRegistry::instance().classifierMLP(), 
                                       voc, transition_p, emission_p);
     }
+    ((OCRHMMDecoder*)ocr)->setPruning(HMM_TOP_K, HMM_BEAM);
+    if (!string(HMM_LEXICON).empty())
+      ((OCRHMMDecoder*)ocr)->setLexicon(ModelRegistry::instance().lexicon(HMM_LEXICON));
   }
 
   cout << "TIME_OCR_INITIALIZATION_ALT = "<< ((double)getTickCount() - t_r)*1000/getTickFrequency() << endl;
@@ -183,33 +191,54 @@ int main(int argc, char* argv[])
  
   t_r = getTickCount();
 
+  // With Tesseract on the plain grey crops all the groups share the same input image,
+  // so it is handed over once and each group is recognized from its own rectangle
+  vector<string>           batch_outputs;
+  vector< vector<Rect> >   batch_boxes;
+  vector< vector<string> > batch_words;
+  vector< vector<float> >  batch_confidences;
+  if ((RECOGNITION == 0) && (SEGMENTATION == 2))
+  {
+    vector<Rect> rois;
+    for (int i=0; i<nm_boxes.size(); i++)
+      rois.push_back(crop_roi(nm_boxes[i], image.size()));
+    ((OCRTesseract*)ocr)->run(grey, rois, batch_outputs, &batch_boxes, &batch_words, &batch_confidences, OCR_LEVEL_WORD);
+  }
+
+  er_draw_workspace ws;
+  OCRHMMDecoder::Workspace hmm_ws; // decoder scratch, reused by all the groups
   for (int i=0; i<nm_boxes.size(); i++)
   {
 
     rectangle(out_img_detection, nm_boxes[i].tl(), nm_boxes[i].br(), Scalar(0,255,255), 3);
 
-    Mat group_img = Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
-    Mat group_segmentation;
+    Mat group_img;
+    Mat group_segmentation; // drawn in out_img_segmentation at segmentation_roi
+    Rect segmentation_roi;
     if ((SEGMENTATION == 0)||(SEGMENTATION == 1))
     {
-      er_draw(channels, regions, nm_region_groups[i], group_img);
+      // the group box plus a 15 pixels border, as a bordered crop of a full size mask
+      segmentation_roi = (nm_boxes[i] + Size(30,30)) - Point(15,15);
+      group_segmentation = er_draw_roi(channels, regions, nm_region_groups[i], segmentation_roi, ws);
       if (SEGMENTATION == 1)
-        GaussianBlur( group_img, group_img, Size( 3, 3 ), 0, 0 );
-      group_img.copyTo(group_segmentation);
-      group_img(nm_boxes[i]).copyTo(group_img);
-      copyMakeBorder(group_img,group_img,15,15,15,15,BORDER_CONSTANT,Scalar(0));
+        GaussianBlur( group_segmentation, group_segmentation, Size( 3, 3 ), 0, 0, BORDER_DEFAULT|BORDER_ISOLATED );
+      if (RECOGNITION != 0)
+      {
+        group_segmentation(Rect(15,15,nm_boxes[i].width,nm_boxes[i].height)).copyTo(group_img);
+        copyMakeBorder(group_img,group_img,15,15,15,15,BORDER_CONSTANT,Scalar(0));
+      }
+      else
+        group_img = group_segmentation;
     } else {
-      group_segmentation = Mat::zeros(image.rows+2, image.cols+2, CV_8UC1);
-      Rect roi = (nm_boxes[i] + Size(10,10)) - Point(5,5);
-      roi.x = max(roi.x,0); roi.y = max(roi.y,0);
-      roi.width = min(image.cols-roi.x-1,roi.width); roi.height = min(image.rows-roi.y-1,roi.height);
+      Rect roi = crop_roi(nm_boxes[i], image.size());
       cout << roi.x << "," << roi.y << "," << roi.width << "," << roi.height << endl;
-      orig_grey(roi).copyTo(group_img);
+      grey(roi).copyTo(group_img);
       if (SEGMENTATION == 3)
         adaptiveThreshold(group_img, group_img, 255, ADAPTIVE_THRESH_GAUSSIAN_C, THRESH_BINARY, 11, 2);
       if (SEGMENTATION == 4)
         threshold(group_img, group_img, 128, 255, THRESH_BINARY|THRESH_OTSU);
-      group_img.copyTo(group_segmentation(roi));
+      segmentation_roi   = roi;
+      group_segmentation = group_img;
     }
 
     vector<Rect>   boxes;
@@ -218,16 +247,33 @@ int main(int argc, char* argv[])
 
 
     float min_confidence1,min_confidence2;
+    bool  image_coordinates = false; // boxes already given in image coordinates
 
     if (RECOGNITION == 0)
     {
-      ((OCRTesseract*)ocr)->run(group_img, output, &boxes, &words, &confidences, OCR_LEVEL_WORD);
+      if ((SEGMENTATION == 0)||(SEGMENTATION == 1))
+      {
+        ((OCRTesseract*)ocr)->run(group_img, output, &boxes, &words, &confidences, OCR_LEVEL_WORD);
+        for (int j=0; j<boxes.size(); j++)
+          boxes[j] += segmentation_roi.tl();
+        image_coordinates = true;
+      }
+      else if (SEGMENTATION == 2)
+      {
+        output      = batch_outputs[i];
+        boxes       = batch_boxes[i];
+        words       = batch_words[i];
+        confidences = batch_confidences[i];
+        image_coordinates = true;
+      }
+      else
+        ((OCRTesseract*)ocr)->run(group_img, output, &boxes, &words, &confidences, OCR_LEVEL_WORD);
       min_confidence1 = 51.;
       min_confidence2 = 60.;
     }
     else
     {
-      ((OCRHMMDecoder*)ocr)->run(group_img, group_img, output, &boxes, &words, &confidences, OCR_LEVEL_WORD);
+      ((OCRHMMDecoder*)ocr)->run(group_img, group_img, output, hmm_ws, &boxes, &words, &confidences, OCR_LEVEL_WORD);
       min_confidence1 = 0.;
       min_confidence2 = 0.;
     }
@@ -240,8 +286,11 @@ int main(int argc, char* argv[])
 
     for (int j=0; j<boxes.size(); j++)
     {
-      boxes[j].x += nm_boxes[i].x-15;
-      boxes[j].y += nm_boxes[i].y-15;
+      if (!image_coordinates)
+      {
+        boxes[j].x += nm_boxes[i].x-15;
+        boxes[j].y += nm_boxes[i].y-15;
+      }
 
       //cout << "  word = " << words[j] << "\t confidence = " << confidences[j] << endl;
       if ((words[j].size() < 2) || (confidences[j] < min_confidence1) || 
@@ -254,7 +303,7 @@ int main(int argc, char* argv[])
       Size word_size = getTextSize(words[j], FONT_HERSHEY_SIMPLEX, scale_font, 3*scale_font, NULL);
       rectangle(out_img, boxes[j].tl()-Point(3,word_size.height+3), boxes[j].tl()+Point(word_size.width,0), Scalar(255,0,255),-1);
       putText(out_img, words[j], boxes[j].tl()-Point(1,1), FONT_HERSHEY_SIMPLEX, scale_font, Scalar(255,255,255),3*scale_font);
-      out_img_segmentation = out_img_segmentation | group_segmentation;
+      er_draw_or(out_img_segmentation, group_segmentation, segmentation_roi);
     }
 
   }
@@ -433,7 +482,7 @@ bool isRepetitive(const string& s)
 }
 
 
-void er_draw(vector<Mat> &channels, vector<vector<ERStat> > &regions, vector<Vec2i> group, Mat& segmentation)
+void er_draw(vector<Mat> &channels, vector<ERStatArena> &regions, vector<Vec2i> group, Mat& segmentation)
 {
   for (int r=0; r<(int)group.size(); r++)
   {
@@ -447,3 +496,11 @@ void er_draw(vector<Mat> &channels, vector<vector<ERStat> > &regions, vector<Vec
       }
   }
 }
+
+Rect crop_roi(const Rect& box, const Size& image_size)
+{
+  Rect roi = (box + Size(10,10)) - Point(5,5);
+  roi.x = max(roi.x,0); roi.y = max(roi.y,0);
+  roi.width = min(image_size.width-roi.x-1,roi.width); roi.height = min(image_size.height-roi.y-1,roi.height);
+  return roi;
+}
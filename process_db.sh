@@ -1 +1,4 @@
-while read i; do echo $i; j=`echo $i | cut -d " " -f 1`; k=`./end_to_end_recognition $i | grep "distance ratio" | cut -d " " -f 5`; f=`echo $i | cut -d " " -f 1 | cut -d "/" -f 2 | cut -d "." -f 1`; mv detection.jpg results/$k.$f.detection.jpg; mv recognition.jpg results/$k.$f.recognition.jpg; cp $j results/$k.$f.original.jpg; montage results/$k.$f.original.jpg results/$k.$f.detection.jpg results/$k.$f.recognition.jpg -tile 3x1 -geometry 640x+10+10 results/$k.$f.montage.jpg; convert results/$k.$f.montage.jpg -background white -size x39 label:"edit distance ratio $k" +swap -gravity Center -append results/$k.$f.montage.jpg; done < test/list.txt
+mkdir -p batch_images; ./end_to_end_recognition --batch test/list.txt batch_images | python -c 'import json,sys
+for l in sys.stdin:
+  r = json.loads(l)
+  if "evaluation" in r: print r["image"], r["evaluation"]["edit_distance_ratio"]' | while read j k; do echo $j; f=`echo $j | cut -d "/" -f 2 | cut -d "." -f 1`; mv batch_images/$f.detection.jpg results/$k.$f.detection.jpg; mv batch_images/$f.recognition.jpg results/$k.$f.recognition.jpg; cp $j results/$k.$f.original.jpg; montage results/$k.$f.original.jpg results/$k.$f.detection.jpg results/$k.$f.recognition.jpg -tile 3x1 -geometry 640x+10+10 results/$k.$f.montage.jpg; convert results/$k.$f.montage.jpg -background white -size x39 label:"edit distance ratio $k" +swap -gravity Center -append results/$k.$f.montage.jpg; done
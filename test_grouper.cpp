@@ -0,0 +1,133 @@
+#include <opencv2/opencv.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <iostream>
+#include <algorithm>
+
+#include "model_registry.h"
+#include "image_context.h"
+#include "erdetection_nm.h"
+#include "ergrouping_nm.h"
+
+using namespace cv;
+using namespace std;
+
+//Groups the regions of channel c with an ERGrouperNM fed in pieces: the selected regions are
+//added in shuffled chunks, some of them removed and added back, as the feedback loop does
+void   incrementalGroups(Mat &grey, Mat &lab, vector<Mat> &channels, vector<ERStatArena> &regions, size_t c,
+                         vector< vector<Vec2i> > &groups, vector<Rect> &boxes, int &pair_mismatches);
+//True if both sets of groups (and boxes) are the same, in the same order
+bool   sameGroups(vector< vector<Vec2i> > &groups1, vector<Rect> &boxes1, vector< vector<Vec2i> > &groups2, vector<Rect> &boxes2);
+
+//Checks that the groups of ERGrouperNM match the ones of erGroupingNM (no feedback loop) on the regions of an image
+int main(int argc, char* argv[])
+{
+
+  Mat image;
+  if(argc>1)
+    image  = imread(argv[1]);
+  else
+  {
+    cout << "Usage: " << argv[0] << " <img_filename>" << endl;
+    return(0);
+  }
+
+  ImageContext context(image);
+  Mat grey = context.grey();
+  Mat lab  = context.lab();
+  // Extract channels to be processed individually
+  vector<Mat> channels;
+  context.channels(channels);
+
+  vector<ERStatArena> regions(channels.size());
+  Ptr<ERFilter::Callback> er_classifier1 = ModelRegistry::instance().classifierNM1();
+  Ptr<ERFilter::Callback> er_classifier2 = ModelRegistry::instance().classifierNM2();
+  erDetectionNM(channels, regions, er_classifier1, er_classifier2);
+
+  // Reference: exhaustive grouping of all the channels, no feedback loop (it would add regions)
+  vector< vector<Vec2i> > ref_groups;
+  vector<Rect>            ref_boxes;
+  erGroupingNM(context, channels, regions, ref_groups, ref_boxes, false);
+
+  vector< vector<Vec2i> > groups;
+  vector<Rect>            boxes;
+  int pair_mismatches = 0;
+  for (size_t c=0; c<channels.size(); c++)
+    incrementalGroups(grey, lab, channels, regions, c, groups, boxes, pair_mismatches);
+
+  cout << "erGroupingNM groups = " << ref_groups.size() << endl;
+  cout << "ERGrouperNM groups = " << groups.size() << endl;
+  cout << "validPairs mismatches = " << pair_mismatches << endl;
+
+  if (!sameGroups(ref_groups, ref_boxes, groups, boxes) || (pair_mismatches > 0))
+  {
+    cout << "FAILED" << endl;
+    return(1);
+  }
+  cout << "OK" << endl;
+  return(0);
+}
+
+void incrementalGroups(Mat &grey, Mat &lab, vector<Mat> &channels, vector<ERStatArena> &regions, size_t c,
+                       vector< vector<Vec2i> > &groups, vector<Rect> &boxes, int &pair_mismatches)
+{
+  region_table table;
+  buildRegionTable(regions[c], table);
+  selectRegions(regions[c], -1, table.selected);
+
+  vector<int> selected_regions;
+  for (int r=0; r<(int)table.size(); r++)
+    if (table.selected[r])
+      selected_regions.push_back(r);
+
+  srand(1+(unsigned)c);
+  random_shuffle(selected_regions.begin(), selected_regions.end());
+
+  ERGrouperNM grouper(grey, lab, channels[c], table, (int)c);
+
+  // first half in chunks of 7, every third region of it is removed again
+  size_t half = selected_regions.size()/2;
+  vector<int> removed;
+  for (size_t n=0; n<half; n+=7)
+    grouper.addRegions(vector<int>(selected_regions.begin()+n, selected_regions.begin()+min(n+7,half)));
+  for (size_t n=0; n<half; n+=3)
+    removed.push_back(selected_regions[n]);
+  grouper.removeRegions(removed);
+
+  // the partners of a region are the grouped regions it makes a valid pair with
+  Mat mask;
+  for (size_t n=0; n<half; n+=5)
+  {
+    int r = selected_regions[n];
+    vector<int> partners, expected;
+    grouper.validPairs(r, partners);
+    for (int j=0; j<(int)table.size(); j++)
+      if ((j != r) && grouper.isGrouped(j) && isValidPair(grey, lab, mask, channels[c], table, r, j))
+        expected.push_back(j);
+    if (partners != expected)
+      pair_mismatches++;
+  }
+
+  // then the second half one by one and the removed ones back at once
+  for (size_t n=half; n<selected_regions.size(); n++)
+    grouper.addRegions(vector<int>(1, selected_regions[n]));
+  grouper.addRegions(removed);
+
+  grouper.groups(groups, boxes);
+}
+
+bool sameGroups(vector< vector<Vec2i> > &groups1, vector<Rect> &boxes1, vector< vector<Vec2i> > &groups2, vector<Rect> &boxes2)
+{
+  if ((groups1.size() != groups2.size()) || (boxes1.size() != boxes2.size()))
+    return false;
+  for (size_t i=0; i<groups1.size(); i++)
+  {
+    if ((groups1[i] != groups2[i]) || (boxes1[i] != boxes2[i]))
+    {
+      cout << "group " << i << " differs: " << boxes1[i] << " vs " << boxes2[i] << endl;
+      return false;
+    }
+  }
+  return true;
+}